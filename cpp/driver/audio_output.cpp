@@ -55,9 +55,15 @@ bool AudioOutput::UnMute() {
 
 bool AudioOutput::FIFOFlush() {
   if (!bus_) return false;
-  bus_->Write(kConfBaseAddress + 12, 0x0001);
-  bus_->Write(kConfBaseAddress + 12, 0x0000);
-  return true;
+  uint16_t flush[2] = {0x0001, 0x0000};
+  BusSegment segments[2] = {
+      WriteSegment(kConfBaseAddress + 12,
+                   reinterpret_cast<unsigned char *>(&flush[0]),
+                   sizeof(uint16_t)),
+      WriteSegment(kConfBaseAddress + 12,
+                   reinterpret_cast<unsigned char *>(&flush[1]),
+                   sizeof(uint16_t))};
+  return bus_->Transact(segments, 2);
 }
 
 bool AudioOutput::SetOutputSelector(OutputSelector output_selector) {
@@ -99,8 +105,14 @@ uint16_t AudioOutput::GetFIFOStatus() {
   if (!bus_) return false;
   uint16_t write_pointer;
   uint16_t read_pointer;
-  bus_->Read(kAudioOutputBaseAddress + 0x802, &read_pointer);
-  bus_->Read(kAudioOutputBaseAddress + 0x803, &write_pointer);
+  BusSegment segments[2] = {
+      ReadSegment(kAudioOutputBaseAddress + 0x802,
+                  reinterpret_cast<unsigned char *>(&read_pointer),
+                  sizeof(read_pointer)),
+      ReadSegment(kAudioOutputBaseAddress + 0x803,
+                  reinterpret_cast<unsigned char *>(&write_pointer),
+                  sizeof(write_pointer))};
+  if (!bus_->Transact(segments, 2)) return false;
 
   if (write_pointer > read_pointer)
     return write_pointer - read_pointer;
@@ -109,19 +121,27 @@ uint16_t AudioOutput::GetFIFOStatus() {
 }
 
 void AudioOutput::Write() {
-  std::thread pcmt([this] {
-    float sample_time = 1.0 / PCM_sampling_frequency_;
-    uint16_t fifo_status = GetFIFOStatus();
+  float sample_time = 1.0 / PCM_sampling_frequency_;
+  uint16_t fifo_status = GetFIFOStatus();
 
-    if (fifo_status > kFIFOSize * 3 / 4) {
-      int sleep = int(kMaxWriteLength * sample_time * 1000);
-      std::this_thread::sleep_for(std::chrono::milliseconds(sleep));
-    }
-    bus_->Write(kAudioOutputBaseAddress,
-                reinterpret_cast<unsigned char *>(&write_data_[0]),
-                sizeof(uint16_t) * kMaxWriteLength);
-  });
-  pcmt.join();
+  if (fifo_status > kFIFOSize * 3 / 4) {
+    int sleep = int(kMaxWriteLength * sample_time * 1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(sleep));
+  }
+  bus_->Write(kAudioOutputBaseAddress,
+              reinterpret_cast<unsigned char *>(&write_data_[0]),
+              sizeof(uint16_t) * kMaxWriteLength);
+}
+
+std::future<bool> AudioOutput::WriteAsync() {
+  if (!bus_) {
+    std::promise<bool> failed;
+    failed.set_value(false);
+    return failed.get_future();
+  }
+  return bus_->WriteAsync(kAudioOutputBaseAddress,
+                          reinterpret_cast<unsigned char *>(&write_data_[0]),
+                          sizeof(uint16_t) * kMaxWriteLength);
 }
 
 bool AudioOutput::SetVolumen(int volumen_percentage) {
@@ -18,6 +18,7 @@
 #ifndef CPP_DRIVER_AUDIO_OUTPUT_H_
 #define CPP_DRIVER_AUDIO_OUTPUT_H_
 
+#include <future>
 #include <string>
 #include "./matrix_driver.h"
 
@@ -60,6 +61,11 @@ class AudioOutput : public MatrixDriver {
 
   void Write();
 
+  // Queues write_data_ on the bus I/O thread and returns at once; the samples
+  // are copied, so write_data_ can be refilled right away. Unlike Write() it
+  // does not wait for FIFO room, pace the calls with GetFIFOStatus().
+  std::future<bool> WriteAsync();
+
   uint16_t GetFIFOStatus();
 
   bool SetVolumen(int volumen_percentage);
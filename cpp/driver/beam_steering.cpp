@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/beam_steering.h"
+#include <algorithm>
+#include <cmath>
+
+namespace matrix_hal {
+
+static const float kPi = 3.14159265358979f;
+
+SteeringTable::SteeringTable() : azimutal_steps_(0), polar_steps_(0) {}
+
+void SteeringTable::Delays(const float (*geometry)[2],
+                           uint32_t sampling_frequency, float azimutal_angle,
+                           float polar_angle, float radial_distance_mm,
+                           float sound_speed_mmseg, float *delays) {
+  //  sound source position
+  float x = radial_distance_mm * std::sin(azimutal_angle) *
+            std::cos(polar_angle);
+  float y = radial_distance_mm * std::sin(azimutal_angle) *
+            std::sin(polar_angle);
+  float z = radial_distance_mm * std::cos(azimutal_angle);
+
+  float distance[kSteeringChannels];
+  float max_distance = 0;
+  for (int c = 0; c < kSteeringChannels; c++) {
+    distance[c] = std::sqrt(std::pow(geometry[c][0] - x, 2.0f) +
+                            std::pow(geometry[c][1] - y, 2.0f) + z * z);
+    max_distance = std::max(max_distance, distance[c]);
+  }
+
+  for (int c = 0; c < kSteeringChannels; c++)
+    delays[c] =
+        (max_distance - distance[c]) * sampling_frequency / sound_speed_mmseg;
+}
+
+void SteeringTable::Compute(const float (*geometry)[2],
+                            uint32_t sampling_frequency, float azimutal_angle,
+                            float polar_angle, float radial_distance_mm,
+                            float sound_speed_mmseg, int max_delay,
+                            SteeringVector *vector) {
+  float delays[kSteeringChannels];
+  Delays(geometry, sampling_frequency, azimutal_angle, polar_angle,
+         radial_distance_mm, sound_speed_mmseg, delays);
+
+  // The interpolator reads kFractionalDelayTaps - 1 samples behind offset
+  float limit = max_delay - kFractionalDelayTaps + 1;
+  for (int c = 0; c < kSteeringChannels; c++) {
+    float delay = std::min(std::max(delays[c], 0.0f), limit);
+
+    int offset = int(std::floor(delay));
+    float d = 1.0f + (delay - offset);
+    float *taps = vector->taps[c];
+    vector->offset[c] = offset;
+    if (d == 1.0f) {
+      taps[0] = 0;
+      taps[1] = 1;
+      taps[2] = 0;
+      taps[3] = 0;
+      continue;
+    }
+    // Lagrange basis at d for the samples 0, 1, 2 and 3 behind offset
+    taps[0] = -(d - 1) * (d - 2) * (d - 3) / 6;
+    taps[1] = d * (d - 2) * (d - 3) / 2;
+    taps[2] = -d * (d - 1) * (d - 3) / 2;
+    taps[3] = d * (d - 1) * (d - 2) / 6;
+  }
+}
+
+void SteeringTable::Build(const float (*geometry)[2],
+                          uint32_t sampling_frequency, int azimutal_steps,
+                          int polar_steps, float radial_distance_mm,
+                          float sound_speed_mmseg, int max_delay) {
+  azimutal_steps_ = std::max(azimutal_steps, 1);
+  polar_steps_ = std::max(polar_steps, 1);
+  vectors_.resize(Directions());
+
+  for (int i = 0; i < Directions(); i++)
+    Compute(geometry, sampling_frequency, AzimutalAngle(i), PolarAngle(i),
+            radial_distance_mm, sound_speed_mmseg, max_delay, &vectors_[i]);
+}
+
+float SteeringTable::AzimutalAngle(int index) const {
+  if (azimutal_steps_ < 2) return 0;
+  return (index / polar_steps_) * (kPi / 2) / (azimutal_steps_ - 1);
+}
+
+float SteeringTable::PolarAngle(int index) const {
+  return (index % polar_steps_) * (2 * kPi) / polar_steps_;
+}
+
+int SteeringTable::Nearest(float azimutal_angle, float polar_angle) const {
+  if (!Directions()) return -1;
+
+  int azimutal_step = 0;
+  if (azimutal_steps_ > 1)
+    azimutal_step =
+        int(std::round(azimutal_angle / (kPi / 2) * (azimutal_steps_ - 1)));
+  azimutal_step = std::min(std::max(azimutal_step, 0), azimutal_steps_ - 1);
+
+  float turns = polar_angle / (2 * kPi);
+  turns -= std::floor(turns);
+  int polar_step = int(std::round(turns * polar_steps_)) % polar_steps_;
+
+  return Index(azimutal_step, polar_step);
+}
+
+static inline int16_t Saturate(float value) {
+  long rounded = std::lrint(value);
+  return int16_t(std::min(long(INT16_MAX), std::max(rounded, long(INT16_MIN))));
+}
+
+void FractionalDelay(const int16_t *x, int offset, const float *taps,
+                     uint32_t samples, int16_t *out) {
+  const int16_t *p = x - offset;
+  const float t0 = taps[0], t1 = taps[1], t2 = taps[2], t3 = taps[3];
+  for (uint32_t s = 0; s < samples; s++, p++)
+    out[s] = Saturate(t0 * p[0] + t1 * p[-1] + t2 * p[-2] + t3 * p[-3]);
+}
+
+void FractionalDelayCrossfade(const int16_t *x, int from_offset,
+                              const float *from_taps, int to_offset,
+                              const float *to_taps, uint32_t samples,
+                              int16_t *out) {
+  const int16_t *p = x - from_offset;
+  const int16_t *q = x - to_offset;
+  const float step = 1.0f / samples;
+  for (uint32_t s = 0; s < samples; s++, p++, q++) {
+    float from = from_taps[0] * p[0] + from_taps[1] * p[-1] +
+                 from_taps[2] * p[-2] + from_taps[3] * p[-3];
+    float to = to_taps[0] * q[0] + to_taps[1] * q[-1] + to_taps[2] * q[-2] +
+               to_taps[3] * q[-3];
+    float weight = (s + 1) * step;
+    out[s] = Saturate(from + (to - from) * weight);
+  }
+}
+};  // namespace matrix_hal
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_BEAM_STEERING_H_
+#define CPP_DRIVER_BEAM_STEERING_H_
+
+#include <stdint.h>
+#include <vector>
+
+namespace matrix_hal {
+
+const int kSteeringChannels = 8;
+// Third order Lagrange interpolator
+const int kFractionalDelayTaps = 4;
+
+/*
+Per-channel fractional delays for one look direction. Channel c is output
+as sum over k of taps[c][k] * x[s - offset[c] - k], a delay of
+offset[c] + 1 + fraction samples. The extra sample is common to all
+channels and keeps the interpolator in its accurate range.
+*/
+struct SteeringVector {
+  int offset[kSteeringChannels];
+  float taps[kSteeringChannels][kFractionalDelayTaps];
+};
+
+/*
+Steering vectors precomputed on a grid of directions. The grid spans
+|azimutal_steps| angles from the board normal (0) to the board plane
+(pi / 2), and |polar_steps| angles around it, with the same convention as
+MicrophoneArray::CalculateDelays.
+*/
+class SteeringTable {
+ public:
+  SteeringTable();
+
+  // |geometry| holds the (x, y) position of each microphone in mm. Delays
+  // are limited to |max_delay| samples.
+  void Build(const float (*geometry)[2], uint32_t sampling_frequency,
+             int azimutal_steps, int polar_steps, float radial_distance_mm,
+             float sound_speed_mmseg, int max_delay);
+
+  int Directions() const { return azimutal_steps_ * polar_steps_; }
+  int AzimutalSteps() const { return azimutal_steps_; }
+  int PolarSteps() const { return polar_steps_; }
+
+  int Index(int azimutal_step, int polar_step) const {
+    return azimutal_step * polar_steps_ + polar_step;
+  }
+  float AzimutalAngle(int index) const;
+  float PolarAngle(int index) const;
+
+  // Grid direction closest to the given angles
+  int Nearest(float azimutal_angle, float polar_angle) const;
+
+  const SteeringVector &Vector(int index) const { return vectors_[index]; }
+
+  // Delay of each channel, in samples, that lines it up with the last
+  // channel reached by a source at the given position
+  static void Delays(const float (*geometry)[2], uint32_t sampling_frequency,
+                     float azimutal_angle, float polar_angle,
+                     float radial_distance_mm, float sound_speed_mmseg,
+                     float *delays);
+
+  // Steering towards a single source position, delaying the microphones
+  // the sound reaches first so every channel lines up with the last one.
+  static void Compute(const float (*geometry)[2], uint32_t sampling_frequency,
+                      float azimutal_angle, float polar_angle,
+                      float radial_distance_mm, float sound_speed_mmseg,
+                      int max_delay, SteeringVector *vector);
+
+ private:
+  int azimutal_steps_;
+  int polar_steps_;
+  std::vector<SteeringVector> vectors_;
+};
+
+// out[s] = sum over k of taps[k] * x[s - offset - k] for s < samples,
+// rounded and saturated. |x| must have offset + kFractionalDelayTaps - 1
+// samples of history in front of it.
+void FractionalDelay(const int16_t *x, int offset, const float *taps,
+                     uint32_t samples, int16_t *out);
+
+// As FractionalDelay, fading linearly from the |from| delay to the |to|
+// delay over the block, so a steering change never clicks.
+void FractionalDelayCrossfade(const int16_t *x, int from_offset,
+                              const float *from_taps, int to_offset,
+                              const float *to_taps, uint32_t samples,
+                              int16_t *out);
+
+// True when |taps| pick a single sample, x[s - offset - 1]
+inline bool IsIntegerDelay(const float *taps) {
+  return taps[0] == 0 && taps[1] == 1 && taps[2] == 0 && taps[3] == 0;
+}
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_BEAM_STEERING_H_
@@ -21,9 +21,36 @@
 #include <stdint.h>
 #include <mutex>
 #include <string>
+#include "./transfer_buffer.h"
 
 namespace matrix_hal {
 
+// Largest number of segments in one Transact call
+const int kMaxBusSegments = 32;
+
+// One read or write segment of a vectored bus transaction. Each segment
+// carries its own address header, so consecutive segments may target
+// unrelated registers.
+struct BusSegment {
+  uint16_t address;
+  unsigned char *data;
+  int length;
+  bool read;
+  // Deassert chip select after this segment. Ignored on the last segment of
+  // a transaction, where chip select is always released.
+  bool cs_change;
+};
+
+inline BusSegment ReadSegment(uint16_t add, unsigned char *data, int length) {
+  BusSegment segment = {add, data, length, true, true};
+  return segment;
+}
+
+inline BusSegment WriteSegment(uint16_t add, unsigned char *data, int length) {
+  BusSegment segment = {add, data, length, false, true};
+  return segment;
+}
+
 class Bus {
  public:
   virtual ~Bus(){};
@@ -34,12 +61,27 @@ class Bus {
 
   virtual bool Read(uint16_t add, unsigned char *data, int length) = 0;
 
+  // Submits all |count| segments under a single lock acquisition, in order.
+  virtual bool Transact(BusSegment *segments, int count) = 0;
+
+  // Bytes a caller must reserve in front of the payload for ReadInPlace.
+  virtual int ReadHeadroom() { return 0; }
+
+  // Reads |length| bytes without staging them in a transfer buffer. |buffer| must
+  // hold ReadHeadroom() + |length| bytes, be 4-byte aligned, and receives the
+  // payload at buffer + ReadHeadroom().
+  virtual bool ReadInPlace(uint16_t add, unsigned char *buffer, int length) {
+    return Read(add, buffer + ReadHeadroom(), length);
+  }
+
   virtual void Close() = 0;
 
  protected:
   std::string device_name_;
-  unsigned char rx_buffer_[12288];
-  unsigned char tx_buffer_[12288];
+  // Staging memory for packed transfers, used under mutex_. MatrixIOBus
+  // holds the arbiter grant across every call, so calls never run
+  // concurrently and one grow-only buffer is enough.
+  TransferBuffer staging_;
   mutable std::mutex mutex_;
 };
 };      // namespace matrix_hal
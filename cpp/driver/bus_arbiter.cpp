@@ -0,0 +1,154 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/bus_arbiter.h"
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include "cpp/driver/creator_memory_map.h"
+
+namespace matrix_hal {
+
+static const char *kBusPriorityNames[kBusPriorityClasses] = {
+    "audio stream", "audio output", "sensors", "control"};
+
+BusPriority BusPriorityOf(uint16_t add) {
+  switch (add & 0xF000) {
+    case kMicrophoneArrayBaseAddress:
+      return kBusPriorityAudioStream;
+    case kAudioOutputBaseAddress:
+      return kBusPriorityAudioOutput;
+    case kMCUBaseAddress:
+    case kUartBaseAddress:
+      return kBusPrioritySensors;
+    default:
+      return kBusPriorityControl;
+  }
+}
+
+BusArbiter::BusArbiter() : busy_(false) {
+  memset(waiting_, 0, sizeof(waiting_));
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+void BusArbiter::AcquireLocked(std::unique_lock<std::mutex> &lock,
+                               BusPriority priority) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+  waiting_[priority]++;
+  grant_cv_[priority].wait(lock, [this, priority] {
+    if (busy_) return false;
+    for (int p = 0; p < priority; p++)
+      if (waiting_[p]) return false;
+    return true;
+  });
+  waiting_[priority]--;
+  busy_ = true;
+
+  uint64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  stats_.requests[priority]++;
+  stats_.wait_ns[priority] += wait_ns;
+  if (wait_ns > stats_.max_wait_ns[priority])
+    stats_.max_wait_ns[priority] = wait_ns;
+}
+
+void BusArbiter::ReleaseLocked() {
+  busy_ = false;
+  for (int p = 0; p < kBusPriorityClasses; p++) {
+    if (waiting_[p]) {
+      grant_cv_[p].notify_all();
+      return;
+    }
+  }
+}
+
+void BusArbiter::Acquire(BusPriority priority) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  AcquireLocked(lock, priority);
+}
+
+void BusArbiter::Release() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ReleaseLocked();
+}
+
+bool BusArbiter::CoalescedWrite(
+    BusPriority priority, uint16_t add, const unsigned char *data, int length,
+    const std::function<bool(uint16_t, const unsigned char *, int)>
+        &transfer) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  for (std::list<std::shared_ptr<PendingWrite> >::iterator it =
+           pending_.begin();
+       it != pending_.end(); ++it) {
+    std::shared_ptr<PendingWrite> queued = *it;
+    if (queued->add != add || int(queued->data.size()) != length) continue;
+
+    queued->data.assign(data, data + length);
+    stats_.coalesced[priority]++;
+    done_cv_.wait(lock, [queued] { return queued->done; });
+    return queued->result;
+  }
+
+  std::shared_ptr<PendingWrite> write(new PendingWrite());
+  write->add = add;
+  write->data.assign(data, data + length);
+  write->done = false;
+  write->result = false;
+  pending_.push_back(write);
+
+  AcquireLocked(lock, priority);
+  // Once granted the data is frozen, later writers queue a new transfer
+  pending_.remove(write);
+  lock.unlock();
+
+  bool result = transfer(add, write->data.data(), length);
+
+  lock.lock();
+  write->done = true;
+  write->result = result;
+  done_cv_.notify_all();
+  ReleaseLocked();
+  return result;
+}
+
+BusArbiterStats BusArbiter::Stats() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void BusArbiter::ResetStats() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+void BusArbiter::ShowStatistics() {
+  BusArbiterStats stats = Stats();
+  std::cout << "Bus Arbitration: " << std::endl;
+  for (int p = 0; p < kBusPriorityClasses; p++) {
+    uint64_t mean_ns =
+        stats.requests[p] ? stats.wait_ns[p] / stats.requests[p] : 0;
+    std::cout << kBusPriorityNames[p] << " : requests " << stats.requests[p]
+              << ", mean wait " << mean_ns / 1000 << " us, max wait "
+              << stats.max_wait_ns[p] / 1000 << " us, coalesced "
+              << stats.coalesced[p] << std::endl;
+  }
+}
+};  // namespace matrix_hal
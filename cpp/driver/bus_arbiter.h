@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_BUS_ARBITER_H_
+#define CPP_DRIVER_BUS_ARBITER_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace matrix_hal {
+
+// Lower value wins the bus first
+enum BusPriority {
+  kBusPriorityAudioStream = 0,
+  kBusPriorityAudioOutput = 1,
+  kBusPrioritySensors = 2,
+  kBusPriorityControl = 3  // everloop, GPIO and configuration
+};
+const int kBusPriorityClasses = 4;
+
+// Largest low-priority transfer issued in one grant. Sensor and control
+// traffic is split into chunks of this size so a waiting microphone read
+// is delayed by at most one chunk.
+const int kBusArbitrationChunk = 512;
+
+BusPriority BusPriorityOf(uint16_t add);
+
+struct BusArbiterStats {
+  uint64_t requests[kBusPriorityClasses];
+  uint64_t wait_ns[kBusPriorityClasses];
+  uint64_t max_wait_ns[kBusPriorityClasses];
+  // Writes merged into a queued write to the same registers
+  uint64_t coalesced[kBusPriorityClasses];
+};
+
+/*
+Grants the bus to one request at a time, always to the highest priority
+class with someone waiting.
+*/
+class BusArbiter {
+ public:
+  BusArbiter();
+
+  void Acquire(BusPriority priority);
+  void Release();
+
+  // Performs a control write through |transfer| while holding the bus. A
+  // write still queued for the same (address, length) is overwritten instead
+  // of being sent twice: the last writer wins and both callers get the
+  // result of the single transfer.
+  bool CoalescedWrite(
+      BusPriority priority, uint16_t add, const unsigned char *data,
+      int length,
+      const std::function<bool(uint16_t, const unsigned char *, int)>
+          &transfer);
+
+  BusArbiterStats Stats();
+  void ResetStats();
+  void ShowStatistics();
+
+ private:
+  struct PendingWrite {
+    uint16_t add;
+    std::vector<unsigned char> data;
+    bool done;
+    bool result;
+  };
+
+  void AcquireLocked(std::unique_lock<std::mutex> &lock, BusPriority priority);
+  void ReleaseLocked();
+
+  std::mutex mutex_;
+  std::condition_variable grant_cv_[kBusPriorityClasses];
+  std::condition_variable done_cv_;
+  bool busy_;
+  int waiting_[kBusPriorityClasses];
+  std::list<std::shared_ptr<PendingWrite> > pending_;
+  BusArbiterStats stats_;
+};
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_BUS_ARBITER_H_
@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include "cpp/driver/creator_memory_map.h"
@@ -41,6 +42,7 @@ struct hardware_address {
 
 BusDirect::BusDirect()
     : spi_fd_(0),
+      spi_bufsiz_(kSpidevDefaultBufsiz),
       spi_mode_(3),
       spi_bits_(8),
       spi_speed_(15000000),
@@ -59,6 +61,14 @@ bool BusDirect::Init(std::string device_name) {
 
   std::unique_lock<std::mutex> lock(mutex_);
 
+  spi_bufsiz_ = kSpidevDefaultBufsiz;
+  FILE *bufsiz = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+  if (bufsiz) {
+    unsigned int value;
+    if (fscanf(bufsiz, "%u", &value) == 1 && value > 2) spi_bufsiz_ = value;
+    fclose(bufsiz);
+  }
+
   spi_fd_ = open(device_name_.c_str(), O_RDWR);
   if (spi_fd_ < 0) {
     return false;
@@ -103,19 +113,23 @@ bool BusDirect::Init(std::string device_name) {
   return true;
 }
 
-bool BusDirect::SpiTransfer(unsigned char *send_buffer,
-                            unsigned char *receive_buffer, unsigned int size) {
-  spi_ioc_transfer tr;
-  memset(&tr, 0, sizeof(tr));
-
-  tr.tx_buf = (uint64_t)send_buffer;
-  tr.rx_buf = (uint64_t)receive_buffer;
-  tr.len = size;
-  tr.delay_usecs = spi_delay_;
-  tr.speed_hz = spi_speed_;
-  tr.bits_per_word = spi_bits_;
+void BusDirect::SetupTransfer(spi_ioc_transfer *transfer, unsigned char *tx,
+                              unsigned char *rx, unsigned int size) {
+  memset(transfer, 0, sizeof(*transfer));
+  // A null tx_buf makes spidev clock out zeros, a null rx_buf discards input
+  transfer->tx_buf = (uint64_t)tx;
+  transfer->rx_buf = (uint64_t)rx;
+  transfer->len = size;
+  transfer->delay_usecs = spi_delay_;
+  transfer->speed_hz = spi_speed_;
+  transfer->bits_per_word = spi_bits_;
+}
 
-  if (ioctl(spi_fd_, SPI_IOC_MESSAGE(1), &tr) < 1) {
+bool BusDirect::SpiMessage(spi_ioc_transfer *transfers, int count) {
+  // SPI_IOC_MESSAGE(N) spelled out, so the size needs no variable-length array
+  unsigned long request =
+      _IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0, sizeof(spi_ioc_transfer) * count);
+  if (ioctl(spi_fd_, request, transfers) < 1) {
     std::cerr << "can't send spi message" << std::endl;
     return false;
   }
@@ -123,31 +137,135 @@ bool BusDirect::SpiTransfer(unsigned char *send_buffer,
 }
 
 bool BusDirect::Read(uint16_t add, unsigned char *data, int length) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  int chunk = ChunkLength();
+  hardware_address header;
+  spi_ioc_transfer tr[2];
 
-  hardware_address *hw_addr = reinterpret_cast<hardware_address *>(tx_buffer_);
-  hw_addr->reg = add;
-  hw_addr->readnwrite = 1;
+  std::unique_lock<std::mutex> lock(mutex_);
 
-  if (SpiTransfer(tx_buffer_, rx_buffer_, length + 2)) {
-    memcpy(data, &rx_buffer_[2], length);
-    return true;
+  // Transfers larger than spidev's bufsiz are split into messages with
+  // their own header. Within a message chip select is held: the header is
+  // clocked out and the payload lands straight in |data|.
+  for (int offset = 0; offset < length; offset += chunk) {
+    int size = std::min(chunk, length - offset);
+    header.reg = add + offset / 2;
+    header.readnwrite = 1;
+    SetupTransfer(&tr[0], reinterpret_cast<unsigned char *>(&header), NULL,
+                  sizeof(header));
+    SetupTransfer(&tr[1], NULL, data + offset, size);
+    if (!SpiMessage(tr, 2)) return false;
   }
-  return false;
+  return true;
 }
 
 bool BusDirect::Write(uint16_t add, unsigned char *data, int length) {
+  int chunk = ChunkLength();
+  int chunks = length > 0 ? (length + chunk - 1) / chunk : 1;
+
   std::unique_lock<std::mutex> lock(mutex_);
+  unsigned char *tx = staging_.Reserve(length + 2 * chunks);
+  if (!tx) return false;
 
-  hardware_address *hw_addr = reinterpret_cast<hardware_address *>(tx_buffer_);
-  hw_addr->reg = add;
-  hw_addr->readnwrite = 0;
+  unsigned char *position = tx;
+  for (int offset = 0; offset < length || offset == 0; offset += chunk) {
+    int size = std::min(chunk, length - offset);
+    hardware_address *hw_addr = reinterpret_cast<hardware_address *>(position);
+    hw_addr->reg = add + offset / 2;
+    hw_addr->readnwrite = 0;
+    memcpy(position + 2, data + offset, size);
+    position += size + 2;
+    if (size == 0) break;
+  }
 
-  memcpy(&tx_buffer_[2], data, length);
-  if (SpiTransfer(tx_buffer_, rx_buffer_, length + 2)) {
-    return true;
+  spi_ioc_transfer tr;
+  position = tx;
+  for (int offset = 0; offset < length || offset == 0; offset += chunk) {
+    int size = std::min(chunk, length - offset);
+    SetupTransfer(&tr, position, NULL, size + 2);
+    if (!SpiMessage(&tr, 1)) return false;
+    position += size + 2;
+    if (size == 0) break;
   }
-  return false;
+  return true;
+}
+
+bool BusDirect::Transact(BusSegment *segments, int count) {
+  if (count <= 0 || count > kMaxBusSegments) return false;
+
+  int chunk = ChunkLength();
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<spi_ioc_transfer> &tr = transfers_;
+
+  // Reads stage only their headers, writes their headers and payload
+  size_t staged = 0;
+  for (int i = 0; i < count; i++) {
+    if (segments[i].length < 0) return false;
+    int chunks = (segments[i].length + chunk - 1) / chunk;
+    if (chunks == 0) chunks = 1;
+    staged += 2 * chunks + (segments[i].read ? 0 : segments[i].length);
+  }
+  unsigned char *tx = staging_.Reserve(staged);
+  if (!tx) return false;
+
+  // Every segment, or every bufsiz chunk of a long one, is a piece: a
+  // header and payload transfer for reads, a single transfer for writes.
+  // Pieces are grouped into messages that stay within bufsiz in each
+  // direction; |messages| holds the index of each message's first transfer.
+  tr.clear();
+  std::vector<size_t> messages(1, 0);
+  unsigned int tx_total = 0;
+  unsigned int rx_total = 0;
+  unsigned char *position = tx;
+  for (int i = 0; i < count; i++) {
+    BusSegment &segment = segments[i];
+    for (int offset = 0; offset < segment.length || offset == 0;
+         offset += chunk) {
+      int size = std::min(chunk, segment.length - offset);
+      unsigned int piece_tx = segment.read ? 2 : size + 2;
+      unsigned int piece_rx = segment.read ? size : 0;
+      if (tr.size() > messages.back() &&
+          (tx_total + piece_tx > spi_bufsiz_ ||
+           rx_total + piece_rx > spi_bufsiz_)) {
+        messages.push_back(tr.size());
+        tx_total = 0;
+        rx_total = 0;
+      }
+      tx_total += piece_tx;
+      rx_total += piece_rx;
+
+      hardware_address *hw_addr =
+          reinterpret_cast<hardware_address *>(position);
+      hw_addr->reg = segment.address + offset / 2;
+      hw_addr->readnwrite = segment.read ? 1 : 0;
+
+      tr.push_back(spi_ioc_transfer());
+      if (segment.read) {
+        SetupTransfer(&tr.back(), position, NULL, 2);
+        tr.push_back(spi_ioc_transfer());
+        SetupTransfer(&tr.back(), NULL, segment.data + offset, size);
+        position += 2;
+      } else {
+        memcpy(position + 2, segment.data + offset, size);
+        SetupTransfer(&tr.back(), position, NULL, size + 2);
+        position += size + 2;
+      }
+      // The next chunk carries a new header, so chip select has to drop
+      bool last_chunk = offset + size >= segment.length;
+      tr.back().cs_change = (!last_chunk || segment.cs_change) ? 1 : 0;
+      if (size == 0) break;
+    }
+  }
+  messages.push_back(tr.size());
+
+  for (size_t m = 0; m + 1 < messages.size(); m++) {
+    int first = messages[m];
+    int transfers = messages[m + 1] - first;
+    // cs_change on the last transfer would keep the chip selected after
+    // the message
+    tr[first + transfers - 1].cs_change = 0;
+    if (!SpiMessage(&tr[first], transfers)) return false;
+  }
+  return true;
 }
 
 void BusDirect::Close(void) { close(spi_fd_); }
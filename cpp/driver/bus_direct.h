@@ -18,13 +18,19 @@
 #ifndef CPP_DRIVER_BUS_DIRECT_H_
 #define CPP_DRIVER_BUS_DIRECT_H_
 
+#include <linux/spi/spidev.h>
 #include <stdint.h>
 #include <mutex>
 #include <string>
+#include <vector>
 #include "./bus.h"
 
 namespace matrix_hal {
 
+// spidev's default per-message limit, used when the module parameter can't
+// be read
+const unsigned int kSpidevDefaultBufsiz = 4096;
+
 class BusDirect : public Bus {
  public:
   BusDirect();
@@ -36,14 +42,22 @@ class BusDirect : public Bus {
 
   virtual bool Read(uint16_t add, unsigned char *data, int length);
 
+  virtual bool Transact(BusSegment *segments, int count);
+
   virtual void Close();
 
  private:
-  bool SpiTransfer(unsigned char *send_buffer, unsigned char *receive_buffer,
-                   unsigned int size);
+  bool SpiMessage(spi_ioc_transfer *transfers, int count);
+  void SetupTransfer(spi_ioc_transfer *transfer, unsigned char *tx,
+                     unsigned char *rx, unsigned int size);
+  // Largest payload that fits in one spidev message next to its header
+  int ChunkLength() const { return (spi_bufsiz_ - 2) & ~1u; }
 
  private:
   int spi_fd_;
+  // Bytes spidev accepts per message in each direction
+  unsigned int spi_bufsiz_;
+  std::vector<spi_ioc_transfer> transfers_;
   unsigned int spi_fifo_size_;
   unsigned int spi_mode_;
   unsigned int spi_bits_;
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/bus_io_queue.h"
+#include "cpp/driver/matrixio_bus.h"
+
+namespace matrix_hal {
+
+BusIOQueue::BusIOQueue(MatrixIOBus *bus)
+    : bus_(bus), head_(&stub_), tail_(&stub_), running_(true),
+      sleeping_(false) {
+  stub_.next.store(NULL);
+  io_thread_ = std::thread(&BusIOQueue::IOThread, this);
+}
+
+BusIOQueue::~BusIOQueue() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  cv_.notify_one();
+  io_thread_.join();
+}
+
+void BusIOQueue::Submit(const BusSegment &segment,
+                        const std::function<void(bool)> &done) {
+  Request *request = new Request();
+  request->segment = segment;
+  request->done = done;
+  if (!segment.read) {
+    request->payload.assign(segment.data, segment.data + segment.length);
+    request->segment.data = request->payload.data();
+  }
+  Push(request);
+
+  // Pairs with the sleeping_ store in IOThread: either the I/O thread sees
+  // this request before waiting, or we see it asleep and wake it.
+  if (sleeping_.load()) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.notify_one();
+  }
+}
+
+void BusIOQueue::Push(Request *request) {
+  request->next.store(NULL, std::memory_order_relaxed);
+  Request *prev = head_.exchange(request);
+  prev->next.store(request, std::memory_order_release);
+}
+
+BusIOQueue::Request *BusIOQueue::Pop() {
+  Request *tail = tail_;
+  Request *next = tail->next.load(std::memory_order_acquire);
+  if (tail == &stub_) {
+    if (!next) return NULL;
+    tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  // A producer is between its exchange and its link, try again later
+  if (tail != head_.load()) return NULL;
+  Push(&stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  return NULL;
+}
+
+bool BusIOQueue::Empty() { return tail_ == &stub_ && head_.load() == &stub_; }
+
+void BusIOQueue::IOThread() {
+  std::vector<Request *> batch;
+  while (true) {
+    Request *request;
+    while ((request = Pop())) batch.push_back(request);
+
+    if (!batch.empty()) {
+      Execute(batch);
+      batch.clear();
+      continue;
+    }
+
+    if (!Empty()) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleeping_ = true;
+    cv_.wait(lock, [this] { return !running_ || !Empty(); });
+    sleeping_ = false;
+    if (!running_ && Empty()) return;
+  }
+}
+
+void BusIOQueue::Execute(std::vector<Request *> &batch) {
+  BusSegment segments[kMaxBusSegments];
+
+  for (size_t first = 0; first < batch.size();) {
+    // Gather the run of requests that fits in one arbitration chunk. The
+    // transaction is granted at the priority of its segments, so the run
+    // stops at the first request of another class.
+    const BusPriority priority = BusPriorityOf(batch[first]->segment.address);
+    size_t last = first;
+    int bytes = 0;
+    while (last < batch.size() && last - first < size_t(kMaxBusSegments) &&
+           (last == first ||
+            (BusPriorityOf(batch[last]->segment.address) == priority &&
+             bytes + batch[last]->segment.length <= kBusArbitrationChunk))) {
+      bytes += batch[last]->segment.length;
+      last++;
+    }
+
+    bool result;
+    if (last - first == 1) {
+      // Lone or oversized request, MatrixIOBus splits it as needed
+      BusSegment &segment = batch[first]->segment;
+      result = segment.read
+                   ? bus_->Read(segment.address, segment.data, segment.length)
+                   : bus_->Write(segment.address, segment.data,
+                                 segment.length);
+    } else {
+      for (size_t i = first; i < last; i++)
+        segments[i - first] = batch[i]->segment;
+      result = bus_->Transact(segments, int(last - first));
+    }
+
+    // A failed transaction may have applied some of its writes, so it is
+    // not sent again: every request of the run gets the failure
+    for (size_t i = first; i < last; i++) {
+      if (batch[i]->done) batch[i]->done(result);
+      delete batch[i];
+    }
+    first = last;
+  }
+}
+};  // namespace matrix_hal
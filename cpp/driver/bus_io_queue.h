@@ -0,0 +1,80 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_BUS_IO_QUEUE_H_
+#define CPP_DRIVER_BUS_IO_QUEUE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "./bus.h"
+#include "./bus_arbiter.h"
+
+namespace matrix_hal {
+
+class MatrixIOBus;
+
+/*
+Asynchronous bus submissions. Any thread may Submit; a single I/O thread
+drains the lock-free queue and sends runs of adjacent requests of the same
+priority class to the bus as one MatrixIOBus::Transact. A run never holds
+more than kBusArbitrationChunk bytes, so it keeps the bus no longer than
+a single split transfer would.
+*/
+class BusIOQueue {
+ public:
+  explicit BusIOQueue(MatrixIOBus *bus);
+  ~BusIOQueue();
+
+  // Queues |segment|. Write payloads are copied, so the caller's buffer may
+  // be reused at once; read buffers must stay valid until |done| runs.
+  // |done| runs on the I/O thread and must not block.
+  void Submit(const BusSegment &segment, const std::function<void(bool)> &done);
+
+ private:
+  struct Request {
+    std::atomic<Request *> next;
+    BusSegment segment;
+    std::vector<unsigned char> payload;
+    std::function<void(bool)> done;
+  };
+
+  void Push(Request *request);
+  Request *Pop();
+  bool Empty();
+  void IOThread();
+  void Execute(std::vector<Request *> &batch);
+
+  MatrixIOBus *bus_;
+
+  // Intrusive multi-producer single-consumer queue (D. Vyukov)
+  std::atomic<Request *> head_;
+  Request *tail_;
+  Request stub_;
+
+  std::atomic<bool> running_;
+  std::atomic<bool> sleeping_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread io_thread_;
+};
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_BUS_IO_QUEUE_H_
@@ -26,6 +26,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <string>
 
@@ -58,14 +59,16 @@ bool BusKernel::Init(std::string device_name) {
 }
 
 bool BusKernel::Read(uint16_t add, unsigned char *data, int length) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  if (length < 0) return false;
 
-  int32_t *buffer = (int32_t *)rx_buffer_;
+  std::unique_lock<std::mutex> lock(mutex_);
+  int32_t *buffer = (int32_t *)staging_.Reserve(length + 2 * sizeof(int32_t));
+  if (!buffer) return false;
 
   buffer[0] = add;
   buffer[1] = length;
 
-  if (ioctl(regmap_fd_, RD_VALUE, rx_buffer_)) {
+  if (ioctl(regmap_fd_, RD_VALUE, buffer)) {
     return false;
   }
 
@@ -74,21 +77,70 @@ bool BusKernel::Read(uint16_t add, unsigned char *data, int length) {
   return true;
 }
 
-bool BusKernel::Write(uint16_t add, unsigned char *data, int length) {
+bool BusKernel::ReadInPlace(uint16_t add, unsigned char *buffer,
+                            int length) {
   std::unique_lock<std::mutex> lock(mutex_);
 
-  int32_t *buffer = (int32_t *)tx_buffer_;
+  int32_t *header = (int32_t *)buffer;
+
+  header[0] = add;
+  header[1] = length;
+
+  if (ioctl(regmap_fd_, RD_VALUE, buffer)) {
+    return false;
+  }
+  return true;
+}
+
+bool BusKernel::Write(uint16_t add, unsigned char *data, int length) {
+  if (length < 0) return false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  int32_t *buffer = (int32_t *)staging_.Reserve(length + 2 * sizeof(int32_t));
+  if (!buffer) return false;
 
   buffer[0] = add;
   buffer[1] = length;
 
   memcpy(&buffer[2], data, length);
 
-  if (ioctl(regmap_fd_, WR_VALUE, tx_buffer_)) {
+  if (ioctl(regmap_fd_, WR_VALUE, buffer)) {
     return false;
   }
   return true;
 }
 
+bool BusKernel::Transact(BusSegment *segments, int count) {
+  if (count <= 0) return false;
+
+  int longest = 0;
+  for (int i = 0; i < count; i++) {
+    if (segments[i].length < 0) return false;
+    longest = std::max(longest, segments[i].length);
+  }
+
+  // The regmap driver has no vectored ioctl, so the batch is replayed one
+  // segment at a time while the bus stays locked for its whole duration.
+  std::unique_lock<std::mutex> lock(mutex_);
+  unsigned char *raw = staging_.Reserve(longest + 2 * sizeof(int32_t));
+  if (!raw) return false;
+
+  for (int i = 0; i < count; i++) {
+    BusSegment &segment = segments[i];
+    int32_t *buffer = (int32_t *)raw;
+    buffer[0] = segment.address;
+    buffer[1] = segment.length;
+
+    if (segment.read) {
+      if (ioctl(regmap_fd_, RD_VALUE, raw)) return false;
+      memcpy(segment.data, &buffer[2], segment.length);
+    } else {
+      memcpy(&buffer[2], segment.data, segment.length);
+      if (ioctl(regmap_fd_, WR_VALUE, raw)) return false;
+    }
+  }
+  return true;
+}
+
 void BusKernel::Close(void) { close(regmap_fd_); }
 };  // namespace matrix_hal
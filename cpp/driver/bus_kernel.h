@@ -36,6 +36,13 @@ class BusKernel : public Bus {
 
   virtual bool Read(uint16_t add, unsigned char *data, int length);
 
+  virtual bool Transact(BusSegment *segments, int count);
+
+  // The regmap ioctl returns the payload after its {address, length} header
+  virtual int ReadHeadroom() { return 2 * sizeof(int32_t); }
+
+  virtual bool ReadInPlace(uint16_t add, unsigned char *buffer, int length);
+
   virtual void Close();
 
  private:
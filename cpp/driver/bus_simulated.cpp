@@ -0,0 +1,342 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/bus_simulated.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include "cpp/driver/creator_memory_map.h"
+#include "cpp/driver/matrixio_bus.h"
+#include "cpp/driver/microphone_array.h"
+
+namespace matrix_hal {
+
+// Word addressed, 15-bit register space
+const uint32_t kSimulatedRegisters = 0x8000;
+const uint32_t kSimulatedBlockSamples =
+    kMicarrayBufferSize / kMicrophoneChannels;
+
+BusSimulated::BusSimulated()
+    : recording_frames_(0),
+      block_position_(0),
+      block_read_(false),
+      running_(false),
+      real_time_(true),
+      irq_callback_(NULL) {}
+
+BusSimulated::~BusSimulated() { Close(); }
+
+bool BusSimulated::Init(std::string device_name) {
+  Close();
+
+  device_name_ = device_name;
+  if (!LoadRecording(device_name_)) {
+    std::cerr << "can't load simulated recording " << device_name_
+              << std::endl;
+    return false;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    registers_.assign(kSimulatedRegisters, 0);
+    SeedRegisters();
+    block_position_ = 0;
+    block_read_ = false;
+  }
+
+  running_ = true;
+  irq_thread_ = std::thread(&BusSimulated::IRQThread, this);
+  return true;
+}
+
+bool BusSimulated::LoadRecording(const std::string &source) {
+  recording_.clear();
+  recording_frames_ = 0;
+
+  if (source.find("%d") != std::string::npos) {
+    // One mono file per microphone
+    for (int c = 0; c < kMicrophoneChannels; c++) {
+      char filename[4096];
+      snprintf(filename, sizeof(filename), source.c_str(), c + 1);
+      std::vector<std::vector<int16_t> > channel;
+      if (!LoadWav(filename, &channel) || channel.empty()) return false;
+      recording_.push_back(channel[0]);
+    }
+  } else if (source.size() > 4 &&
+             source.compare(source.size() - 4, 4, ".wav") == 0) {
+    if (!LoadWav(source, &recording_)) return false;
+  } else {
+    if (!LoadRaw(source)) return false;
+  }
+
+  if (recording_.empty()) return false;
+  recording_.resize(kMicrophoneChannels);
+
+  recording_frames_ = recording_[0].size();
+  for (size_t c = 0; c < recording_.size(); c++) {
+    // Channels missing from the recording stay silent
+    if (recording_[c].empty()) continue;
+    recording_frames_ = std::min(recording_frames_, recording_[c].size());
+  }
+  for (size_t c = 0; c < recording_.size(); c++)
+    recording_[c].resize(recording_frames_, 0);
+
+  if (recording_frames_ < kSimulatedBlockSamples) return false;
+
+  std::cout << "INFO: [" << source << "] " << recording_frames_
+            << " samples per channel" << std::endl;
+  return true;
+}
+
+bool BusSimulated::LoadWav(const std::string &filename,
+                           std::vector<std::vector<int16_t> > *channels) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file.is_open()) return false;
+
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  if (bytes.size() < 12 || memcmp(&bytes[0], "RIFF", 4) ||
+      memcmp(&bytes[8], "WAVE", 4))
+    return false;
+
+  uint16_t num_channels = 0;
+  uint16_t bits_per_sample = 0;
+  size_t offset = 12;
+  while (offset + 8 <= bytes.size()) {
+    uint32_t chunk_size;
+    memcpy(&chunk_size, &bytes[offset + 4], sizeof(chunk_size));
+    const char *chunk = &bytes[offset + 8];
+    // Recordings cut short leave a stale size in the header
+    size_t available = bytes.size() - offset - 8;
+    if (chunk_size > available) chunk_size = available;
+
+    if (!memcmp(&bytes[offset], "fmt ", 4) && chunk_size >= 16) {
+      memcpy(&num_channels, chunk + 2, sizeof(num_channels));
+      memcpy(&bits_per_sample, chunk + 14, sizeof(bits_per_sample));
+    } else if (!memcmp(&bytes[offset], "data", 4)) {
+      if (bits_per_sample != 16 || num_channels == 0) {
+        std::cerr << filename << ": only 16-bit PCM is supported"
+                  << std::endl;
+        return false;
+      }
+      size_t frames = chunk_size / (sizeof(int16_t) * num_channels);
+      channels->assign(num_channels, std::vector<int16_t>(frames));
+      for (size_t f = 0; f < frames; f++)
+        for (uint16_t c = 0; c < num_channels; c++)
+          memcpy(&(*channels)[c][f],
+                 chunk + (f * num_channels + c) * sizeof(int16_t),
+                 sizeof(int16_t));
+      return true;
+    }
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+  return false;
+}
+
+bool BusSimulated::LoadRaw(const std::string &filename) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file.is_open()) return false;
+
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  size_t frames = bytes.size() / (sizeof(int16_t) * kMicrophoneChannels);
+  recording_.assign(kMicrophoneChannels, std::vector<int16_t>(frames));
+  for (size_t f = 0; f < frames; f++)
+    for (int c = 0; c < kMicrophoneChannels; c++)
+      memcpy(&recording_[c][f],
+             &bytes[(f * kMicrophoneChannels + c) * sizeof(int16_t)],
+             sizeof(int16_t));
+  return true;
+}
+
+void BusSimulated::SeedRegisters() {
+  // Identity of a MATRIX Creator
+  uint32_t identity[2] = {kMatrixCreator, 0x00000010};
+  WriteRegisters(kConfBaseAddress, (unsigned char *)identity,
+                 sizeof(identity));
+
+  // FPGA clock = kFPGAClock * 3 / 1 = 150 MHz
+  uint16_t frequency[2] = {1, 3};
+  WriteRegisters(kConfBaseAddress + 4, (unsigned char *)frequency,
+                 sizeof(frequency));
+
+  // Microphones at 16 kHz, matching the MicrophoneArray defaults
+  registers_[kConfBaseAddress + 0x06] = MIC_sampling_frequencies[2][1];
+  registers_[kConfBaseAddress + 0x07] = MIC_sampling_frequencies[2][2];
+
+  // Audio output FIFO holding a single sample, so writers never throttle
+  registers_[kAudioOutputBaseAddress + 0x802] = 0;
+  registers_[kAudioOutputBaseAddress + 0x803] = 1;
+
+  // MCU sensor block, values in thousandths as the MCU reports them
+  int32_t pressure[3] = {0, 101325 * 1000, 25 * 1000};
+  WriteRegisters(kMCUBaseAddress + (kMemoryOffsetPressure >> 1),
+                 (unsigned char *)pressure, sizeof(pressure));
+  int32_t humidity[2] = {45 * 1000, 25 * 1000};
+  WriteRegisters(kMCUBaseAddress + (kMemoryOffsetHumidity >> 1),
+                 (unsigned char *)humidity, sizeof(humidity));
+  int32_t accel[3] = {0, 0, 1000};
+  WriteRegisters(kMCUBaseAddress + (kMemoryOffsetIMU >> 1),
+                 (unsigned char *)accel, sizeof(accel));
+  uint32_t mcu[2] = {0x10, 0x01};
+  WriteRegisters(kMCUBaseAddress + (kMemoryOffsetMCU >> 1),
+                 (unsigned char *)mcu, sizeof(mcu));
+}
+
+void BusSimulated::WriteRegisters(uint16_t add, const unsigned char *data,
+                                  int length) {
+  size_t bytes = std::min<size_t>(
+      length, (kSimulatedRegisters - add) * sizeof(uint16_t));
+  memcpy(&registers_[add], data, bytes);
+}
+
+void BusSimulated::ReadRegisters(uint16_t add, unsigned char *data,
+                                 int length) {
+  size_t bytes = std::min<size_t>(
+      length, (kSimulatedRegisters - add) * sizeof(uint16_t));
+  memcpy(data, &registers_[add], bytes);
+  memset(data + bytes, 0, length - bytes);
+}
+
+void BusSimulated::ReadMicrophoneBlock(uint16_t add, unsigned char *data,
+                                       int length) {
+  // The FPGA exposes the block channel by channel, see MicrophoneArray::Raw
+  int16_t *samples = reinterpret_cast<int16_t *>(data);
+  uint32_t first = add - kMicrophoneArrayBaseAddress;
+  uint32_t count = length / sizeof(int16_t);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t word = first + i;
+    uint32_t channel = word / kSimulatedBlockSamples;
+    uint32_t sample = word % kSimulatedBlockSamples;
+    if (channel >= kMicrophoneChannels) {
+      samples[i] = 0;
+      continue;
+    }
+    samples[i] =
+        recording_[channel][(block_position_ + sample) % recording_frames_];
+  }
+  if (first + count >= kMicarrayBufferSize) {
+    block_read_ = true;
+    block_cv_.notify_all();
+  }
+}
+
+uint32_t BusSimulated::SamplingRate() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint16_t constant = registers_[kConfBaseAddress + 0x06];
+  for (int i = 0; MIC_sampling_frequencies[i][0] != 0; i++)
+    if (MIC_sampling_frequencies[i][1] == constant)
+      return MIC_sampling_frequencies[i][0];
+  return 16000;
+}
+
+bool BusSimulated::Read(uint16_t add, unsigned char *data, int length) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!running_ || length < 0 || add >= kSimulatedRegisters) return false;
+
+  if (add >= kMicrophoneArrayBaseAddress && add < kEverloopBaseAddress)
+    ReadMicrophoneBlock(add, data, length);
+  else
+    ReadRegisters(add, data, length);
+  return true;
+}
+
+bool BusSimulated::Write(uint16_t add, unsigned char *data, int length) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!running_ || length < 0 || add >= kSimulatedRegisters) return false;
+
+  WriteRegisters(add, data, length);
+  return true;
+}
+
+bool BusSimulated::Transact(BusSegment *segments, int count) {
+  if (count <= 0) return false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!running_) return false;
+
+  for (int i = 0; i < count; i++) {
+    BusSegment &segment = segments[i];
+    if (segment.length < 0 || segment.address >= kSimulatedRegisters)
+      return false;
+    if (!segment.read)
+      WriteRegisters(segment.address, segment.data, segment.length);
+    else if (segment.address >= kMicrophoneArrayBaseAddress &&
+             segment.address < kEverloopBaseAddress)
+      ReadMicrophoneBlock(segment.address, segment.data, segment.length);
+    else
+      ReadRegisters(segment.address, segment.data, segment.length);
+  }
+  return true;
+}
+
+void BusSimulated::IRQThread() {
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now();
+  // Fast mode: whether the IRQ of the block exposed now was raised
+  bool raised = false;
+
+  while (running_) {
+    if (real_time_) {
+      // A new block is ready every NumberOfSamples() / fs, read or not
+      deadline += std::chrono::microseconds(
+          uint64_t(kSimulatedBlockSamples) * 1000000 / SamplingRate());
+      std::this_thread::sleep_until(deadline);
+      std::unique_lock<std::mutex> lock(mutex_);
+      block_position_ =
+          (block_position_ + kSimulatedBlockSamples) % recording_frames_;
+      block_read_ = false;
+    } else {
+      // Hand out the next block only once the previous one was consumed.
+      // Each block raises the IRQ once, as every edge counts as a new block
+      // for the reader; the wait is bounded so a callback attached after
+      // the first block still gets its edge.
+      std::unique_lock<std::mutex> lock(mutex_);
+      block_cv_.wait_for(lock, std::chrono::milliseconds(1),
+                         [this] { return block_read_ || !running_; });
+      if (block_read_) {
+        block_position_ =
+            (block_position_ + kSimulatedBlockSamples) % recording_frames_;
+        block_read_ = false;
+        raised = false;
+      }
+      deadline = std::chrono::steady_clock::now();
+      if (raised) continue;
+    }
+
+    void (*callback)(void) = irq_callback_;
+    if (running_ && callback) {
+      callback();
+      raised = true;
+    }
+  }
+}
+
+void BusSimulated::Close() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_ = false;
+    block_cv_.notify_all();
+  }
+  if (irq_thread_.joinable()) irq_thread_.join();
+}
+};  // namespace matrix_hal
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_BUS_SIMULATED_H_
+#define CPP_DRIVER_BUS_SIMULATED_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./bus.h"
+
+namespace matrix_hal {
+
+/*
+Hardware-free bus that emulates the FPGA memory map. Configuration, MCU,
+everloop and GPIO registers behave as plain memory seeded with the values of
+a MATRIX Creator, while kMicrophoneArrayBaseAddress replays a recording and
+the microphone IRQ is raised from a timer thread.
+*/
+class BusSimulated : public Bus {
+ public:
+  BusSimulated();
+  virtual ~BusSimulated();
+
+  // |device_name| is the recording to replay. Accepted formats:
+  //   - "capture_ch_%d.wav": one mono WAV per microphone, %d is 1..8
+  //   - "capture.wav": a 16-bit WAV with up to 8 channels
+  //   - anything else: raw interleaved int16 samples, 8 channels
+  virtual bool Init(std::string device_name);
+
+  virtual bool Write(uint16_t add, unsigned char *data, int length);
+
+  virtual bool Read(uint16_t add, unsigned char *data, int length);
+
+  virtual bool Transact(BusSegment *segments, int count);
+
+  virtual void Close();
+
+  // true: raise the IRQ at the block cadence of the configured sampling
+  // rate. false: raise it as soon as the previous block has been read, which
+  // replays the recording as fast as the consumer can keep up.
+  void SetRealTime(bool real_time) { real_time_ = real_time; }
+
+  void SetIRQCallback(void (*callback)(void)) { irq_callback_ = callback; }
+
+ private:
+  bool LoadRecording(const std::string &source);
+  bool LoadWav(const std::string &filename,
+               std::vector<std::vector<int16_t> > *channels);
+  bool LoadRaw(const std::string &filename);
+  void SeedRegisters();
+  void WriteRegisters(uint16_t add, const unsigned char *data, int length);
+  void ReadRegisters(uint16_t add, unsigned char *data, int length);
+  void ReadMicrophoneBlock(uint16_t add, unsigned char *data, int length);
+  uint32_t SamplingRate();
+  void IRQThread();
+
+ private:
+  std::vector<uint16_t> registers_;
+  // Recording, one vector per microphone
+  std::vector<std::vector<int16_t> > recording_;
+  size_t recording_frames_;
+  // First frame of the block currently exposed by the FPGA
+  size_t block_position_;
+  bool block_read_;
+  std::condition_variable block_cv_;
+
+  std::thread irq_thread_;
+  std::atomic<bool> running_;
+  std::atomic<bool> real_time_;
+  std::atomic<void (*)(void)> irq_callback_;
+};
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_BUS_SIMULATED_H_
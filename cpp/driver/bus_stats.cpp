@@ -0,0 +1,125 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/bus_stats.h"
+#include <iostream>
+#include <sstream>
+
+namespace matrix_hal {
+
+static const char *kBusRegionNames[kBusStatsRegions] = {
+    "conf", "uart", "microphone", "everloop",
+    "gpio", "mcu",  "audio_output", "zwave"};
+
+BusStats::BusStats() { Reset(); }
+
+const char *BusStats::RegionName(int region) {
+  return kBusRegionNames[region & (kBusStatsRegions - 1)];
+}
+
+void BusStats::Record(uint16_t add, int length, uint64_t lock_wait_ns,
+                      uint64_t transfer_ns, bool result) {
+  Counters &counters = regions_[RegionOf(add)];
+  counters.calls.fetch_add(1, std::memory_order_relaxed);
+  counters.bytes.fetch_add(length, std::memory_order_relaxed);
+  counters.lock_wait_ns.fetch_add(lock_wait_ns, std::memory_order_relaxed);
+  counters.transfer_ns.fetch_add(transfer_ns, std::memory_order_relaxed);
+  if (!result) counters.failures.fetch_add(1, std::memory_order_relaxed);
+
+  int bucket = transfer_ns ? 64 - __builtin_clzll(transfer_ns) : 0;
+  if (bucket >= kBusStatsBuckets) bucket = kBusStatsBuckets - 1;
+  counters.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+BusStatsSnapshot BusStats::Snapshot() const {
+  BusStatsSnapshot snapshot;
+  for (int r = 0; r < kBusStatsRegions; r++) {
+    const Counters &counters = regions_[r];
+    BusRegionStats &stats = snapshot.region[r];
+    stats.calls = counters.calls.load(std::memory_order_relaxed);
+    stats.bytes = counters.bytes.load(std::memory_order_relaxed);
+    stats.lock_wait_ns = counters.lock_wait_ns.load(std::memory_order_relaxed);
+    stats.transfer_ns = counters.transfer_ns.load(std::memory_order_relaxed);
+    stats.failures = counters.failures.load(std::memory_order_relaxed);
+    for (int b = 0; b < kBusStatsBuckets; b++)
+      stats.histogram[b] = counters.histogram[b].load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+void BusStats::Reset() {
+  for (int r = 0; r < kBusStatsRegions; r++) {
+    Counters &counters = regions_[r];
+    counters.calls.store(0, std::memory_order_relaxed);
+    counters.bytes.store(0, std::memory_order_relaxed);
+    counters.lock_wait_ns.store(0, std::memory_order_relaxed);
+    counters.transfer_ns.store(0, std::memory_order_relaxed);
+    counters.failures.store(0, std::memory_order_relaxed);
+    for (int b = 0; b < kBusStatsBuckets; b++)
+      counters.histogram[b].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t BusStats::Percentile(const BusRegionStats &stats, double percentile) {
+  uint64_t total = 0;
+  for (int b = 0; b < kBusStatsBuckets; b++) total += stats.histogram[b];
+  if (total == 0) return 0;
+
+  uint64_t rank = uint64_t(percentile / 100.0 * total);
+  uint64_t seen = 0;
+  for (int b = 0; b < kBusStatsBuckets; b++) {
+    seen += stats.histogram[b];
+    if (seen > rank) return b ? uint64_t(1) << b : 0;
+  }
+  return uint64_t(1) << (kBusStatsBuckets - 1);
+}
+
+void BusStats::ShowStatistics() const {
+  BusStatsSnapshot snapshot = Snapshot();
+  std::cout << "Bus Statistics: " << std::endl;
+  for (int r = 0; r < kBusStatsRegions; r++) {
+    const BusRegionStats &stats = snapshot.region[r];
+    if (!stats.calls) continue;
+    std::cout << RegionName(r) << " : calls " << stats.calls << ", bytes "
+              << stats.bytes << ", mean wait "
+              << stats.lock_wait_ns / stats.calls / 1000
+              << " us, mean transfer " << stats.transfer_ns / stats.calls / 1000
+              << " us, p99 transfer < " << Percentile(stats, 99) / 1000
+              << " us, failures " << stats.failures << std::endl;
+  }
+}
+
+std::string BusStats::JSON() const {
+  BusStatsSnapshot snapshot = Snapshot();
+  std::ostringstream json;
+  json << "{";
+  for (int r = 0; r < kBusStatsRegions; r++) {
+    const BusRegionStats &stats = snapshot.region[r];
+    if (r) json << ",";
+    json << "\"" << RegionName(r) << "\":{\"calls\":" << stats.calls
+         << ",\"bytes\":" << stats.bytes
+         << ",\"lock_wait_ns\":" << stats.lock_wait_ns
+         << ",\"transfer_ns\":" << stats.transfer_ns
+         << ",\"failures\":" << stats.failures << ",\"histogram\":[";
+    for (int b = 0; b < kBusStatsBuckets; b++)
+      json << (b ? "," : "") << stats.histogram[b];
+    json << "]}";
+  }
+  json << "}";
+  return json.str();
+}
+};  // namespace matrix_hal
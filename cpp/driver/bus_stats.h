@@ -0,0 +1,91 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_BUS_STATS_H_
+#define CPP_DRIVER_BUS_STATS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace matrix_hal {
+
+// One region per 0x1000 block of creator_memory_map.h
+const int kBusStatsRegions = 8;
+// Transfer time histogram, bucket b counts transfers of [2^(b-1), 2^b) ns
+const int kBusStatsBuckets = 32;
+
+struct BusRegionStats {
+  uint64_t calls;
+  uint64_t bytes;
+  uint64_t lock_wait_ns;
+  uint64_t transfer_ns;
+  uint64_t failures;
+  uint64_t histogram[kBusStatsBuckets];
+};
+
+struct BusStatsSnapshot {
+  BusRegionStats region[kBusStatsRegions];
+};
+
+inline uint64_t BusStatsClock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/*
+Per-region bus traffic counters. Record is lock-free (relaxed atomic
+increments) so it can sit on every transfer; a snapshot taken while
+transfers run may mix counters from neighbouring calls.
+*/
+class BusStats {
+ public:
+  BusStats();
+
+  static int RegionOf(uint16_t add) {
+    return (add >> 12) & (kBusStatsRegions - 1);
+  }
+  static const char *RegionName(int region);
+
+  void Record(uint16_t add, int length, uint64_t lock_wait_ns,
+              uint64_t transfer_ns, bool result);
+
+  BusStatsSnapshot Snapshot() const;
+  void Reset();
+
+  // Upper bound of the bucket holding the |percentile| transfer time
+  static uint64_t Percentile(const BusRegionStats &stats, double percentile);
+
+  void ShowStatistics() const;
+  std::string JSON() const;
+
+ private:
+  struct Counters {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> lock_wait_ns;
+    std::atomic<uint64_t> transfer_ns;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> histogram[kBusStatsBuckets];
+  };
+
+  Counters regions_[kBusStatsRegions];
+};
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_BUS_STATS_H_
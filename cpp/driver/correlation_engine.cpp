@@ -0,0 +1,305 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/correlation_engine.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace matrix_hal {
+
+// Below this magnitude a bin is treated as silent by PHAT
+static const float kPhatFloor = 1e-12f;
+
+static const double kPi = 3.14159265358979323846;
+
+// Newton steps of the sub-sample peak, from the parabola's estimate
+static const int kRefineSteps = 2;
+
+CorrelationEngine::CorrelationEngine()
+    : order_(0),
+      channels_(0),
+      phat_(false),
+      max_lag_(0),
+      in_(NULL),
+      spectra_(NULL),
+      cross_(NULL),
+      inverse_in_(NULL),
+      result_(NULL),
+      allocated_pairs_(0) {}
+
+CorrelationEngine::~CorrelationEngine() { Release(); }
+
+void CorrelationEngine::Release() {
+  forward_plan_.Release();
+  inverse_plan_.Release();
+
+  if (in_) fftwf_free(in_);
+  if (spectra_) fftwf_free(spectra_);
+  if (cross_) fftwf_free(cross_);
+  if (inverse_in_) fftwf_free(inverse_in_);
+  if (result_) fftwf_free(result_);
+
+  in_ = spectra_ = cross_ = inverse_in_ = result_ = NULL;
+  allocated_pairs_ = 0;
+  pairs_.clear();
+  cosine_.clear();
+  sine_.clear();
+  order_ = channels_ = max_lag_ = 0;
+}
+
+bool CorrelationEngine::Init(int N, int channels) {
+  Release();
+  if (N < 2 || channels < 1) return false;
+  order_ = N;
+  channels_ = channels;
+
+  in_ = (float *)fftwf_malloc(sizeof(float) * order_ * channels_);
+  if (!in_) return false;
+
+  spectra_ = (float *)fftwf_malloc(sizeof(float) * order_ * channels_);
+  if (!spectra_) return false;
+
+  // One plan for all channels, each N floats after the previous one
+  if (!forward_plan_.Init(kFFTRealToHalfcomplex, order_, channels_))
+    return false;
+
+  std::vector<std::pair<int, int> > pairs;
+  for (int a = 0; a < channels_; a++)
+    for (int b = a + 1; b < channels_; b++)
+      pairs.push_back(std::make_pair(a, b));
+  return SetPairs(pairs);
+}
+
+bool CorrelationEngine::SetPairs(
+    const std::vector<std::pair<int, int> > &pairs) {
+  if (!forward_plan_.Valid()) return false;
+  for (size_t p = 0; p < pairs.size(); p++) {
+    if (pairs[p].first < 0 || pairs[p].first >= channels_ ||
+        pairs[p].second < 0 || pairs[p].second >= channels_)
+      return false;
+  }
+
+  const int count = int(pairs.size());
+  if (count != int(pairs_.size()) || !inverse_plan_.Valid()) {
+    inverse_plan_.Release();
+
+    if (count > allocated_pairs_) {
+      if (cross_) fftwf_free(cross_);
+      if (inverse_in_) fftwf_free(inverse_in_);
+      if (result_) fftwf_free(result_);
+      cross_ = (float *)fftwf_malloc(sizeof(float) * order_ * count);
+      inverse_in_ = (float *)fftwf_malloc(sizeof(float) * order_ * count);
+      result_ = (float *)fftwf_malloc(sizeof(float) * order_ * count);
+      if (!cross_ || !inverse_in_ || !result_) {
+        allocated_pairs_ = 0;
+        pairs_.clear();
+        return false;
+      }
+      // A lag window leaves the rest of every result untouched
+      std::memset(result_, 0, sizeof(float) * order_ * count);
+      allocated_pairs_ = count;
+    }
+
+    // The inverse of every pair in one batch as well
+    if (count > 0 &&
+        !inverse_plan_.Init(kFFTHalfcomplexToReal, order_, count))
+      return false;
+  }
+  pairs_ = pairs;
+  return true;
+}
+
+bool CorrelationEngine::SetLagWindow(int max_lag) {
+  if (max_lag < 0 || max_lag >= order_ / 2) return false;
+  max_lag_ = max_lag;
+
+  // Bins with both a real and an imaginary part
+  const int bins = (order_ - 1) / 2;
+  cosine_.assign((max_lag_ + 1) * bins, 0.0f);
+  sine_.assign((max_lag_ + 1) * bins, 0.0f);
+  for (int lag = 1; lag <= max_lag_; lag++) {
+    for (int k = 1; k <= bins; k++) {
+      double phase = 2 * kPi * double(k) * lag / order_;
+      cosine_[lag * bins + k - 1] = float(2 * std::cos(phase));
+      // The imaginary part of bin k is at N - k
+      sine_[lag * bins + bins - k] = float(2 * std::sin(phase));
+    }
+  }
+  if (result_)
+    std::memset(result_, 0, sizeof(float) * order_ * allocated_pairs_);
+  return true;
+}
+
+void CorrelationEngine::EvaluateWindow(float *out, const float *x) {
+  // The halfcomplex inverse at lag l is x[0] + (-1)^l x[N/2]
+  // + sum 2 (Re_k cos(2 pi k l / N) - Im_k sin(2 pi k l / N)). Lags l and
+  // -l share both sums and differ only in the sign of the sine one.
+  const int bins = (order_ - 1) / 2;
+  const float *imaginary = &x[order_ - bins];
+  const bool nyquist = order_ % 2 == 0;
+
+  float dc = x[0];
+  for (int k = 1; k <= bins; k++) dc += 2 * x[k];
+  out[0] = dc + (nyquist ? x[order_ / 2] : 0.0f);
+
+  for (int lag = 1; lag <= max_lag_; lag++) {
+    const float *cosine = &cosine_[lag * bins];
+    const float *sine = &sine_[lag * bins];
+    float even = x[0];
+    float odd = 0.0f;
+    for (int k = 0; k < bins; k++) {
+      even += x[k + 1] * cosine[k];
+      odd += imaginary[k] * sine[k];
+    }
+    if (nyquist) even += lag % 2 ? -x[order_ / 2] : x[order_ / 2];
+
+    out[lag] = even - odd;
+    out[order_ - lag] = even + odd;
+  }
+}
+
+float CorrelationEngine::Peak(int pair, int max_lag, float *height) {
+  // Lags that hold a value, and those with a neighbour on each side
+  const int valid = max_lag_ > 0 ? max_lag_ : order_ / 2 - 1;
+  if (max_lag > valid) max_lag = valid;
+  if (max_lag < 0) max_lag = 0;
+
+  const float *c = Result(pair);
+  int best = 0;
+  float peak = c[0];
+  for (int lag = -max_lag; lag <= max_lag; lag++) {
+    float value = c[(lag + order_) % order_];
+    if (value > peak) {
+      peak = value;
+      best = lag;
+    }
+  }
+  if (height) *height = peak;
+  if (std::abs(best) + 1 > valid) return float(best);
+
+  // Vertex of the parabola through the peak and its neighbours
+  const float before = c[(best - 1 + order_) % order_];
+  const float after = c[(best + 1 + order_) % order_];
+  const float curvature = before - 2 * peak + after;
+  if (curvature >= 0) return float(best);
+  const float lag = best + 0.5f * (before - after) / curvature;
+  return Refine(pair, lag, float(best));
+}
+
+float CorrelationEngine::Refine(int pair, float lag, float best) {
+  // The parabola is biased towards whole samples on the sharp peaks of
+  // PHAT. The correlation between samples is the band limited sum of the
+  // cross spectrum, so a few Newton steps on its derivative find the
+  // true maximum.
+  const float *x = &cross_[pair * order_];
+  const int bins = (order_ - 1) / 2;
+  const float omega = float(2 * kPi / order_);
+
+  for (int step = 0; step < kRefineSteps; step++) {
+    // cos and sin of k * omega * lag by rotation, bin after bin
+    const float rotate_cos = std::cos(omega * lag);
+    const float rotate_sin = std::sin(omega * lag);
+    float cos_k = 1.0f, sin_k = 0.0f;
+    float slope = 0.0f, curvature = 0.0f;
+    for (int k = 1; k <= bins; k++) {
+      const float next = cos_k * rotate_cos - sin_k * rotate_sin;
+      sin_k = sin_k * rotate_cos + cos_k * rotate_sin;
+      cos_k = next;
+      const float re = x[k];
+      const float im = x[order_ - k];
+      slope -= k * (re * sin_k + im * cos_k);
+      curvature -= float(k) * k * (re * cos_k - im * sin_k);
+    }
+    if (order_ % 2 == 0) {
+      const float half = float(order_ / 2);
+      slope -= 0.5f * half * x[order_ / 2] * std::sin(omega * half * lag);
+      curvature -=
+          0.5f * half * half * x[order_ / 2] * std::cos(omega * half * lag);
+    }
+    // Not a maximum here, keep what there is
+    if (curvature >= 0) break;
+
+    float delta = -slope / (omega * curvature);
+    lag = std::min(std::max(lag + delta, best - 1.0f), best + 1.0f);
+  }
+  return lag;
+}
+
+void CorrelationEngine::Whiten(float *x) {
+  const int half = order_ / 2;
+  // DC, and Nyquist for even N, are real
+  x[0] = std::fabs(x[0]) > kPhatFloor ? (x[0] > 0 ? 1.0f : -1.0f) : 0.0f;
+  if (order_ % 2 == 0)
+    x[half] = std::fabs(x[half]) > kPhatFloor ? (x[half] > 0 ? 1.0f : -1.0f)
+                                              : 0.0f;
+
+  for (int j = 1; j < order_ - j; j++) {
+    float magnitude = std::sqrt(x[j] * x[j] + x[order_ - j] * x[order_ - j]);
+    float scale = magnitude > kPhatFloor ? 1.0f / magnitude : 0.0f;
+    x[j] *= scale;
+    x[order_ - j] *= scale;
+  }
+}
+
+void CorrelationEngine::Cross(float *out, const float *x, const float *y) {
+  // x * conj(y), scaled here so the inverse needs no extra pass
+  const float scale = 1.0f / order_;
+  const int half = order_ / 2;
+
+  out[0] = x[0] * y[0] * scale;
+  if (order_ % 2 == 0) out[half] = x[half] * y[half] * scale;
+
+  for (int j = 1; j < order_ - j; j++) {
+    float a = x[j];
+    float b = x[order_ - j];
+    float c = y[j];
+    float d = -y[order_ - j];
+    out[j] = (a * c - b * d) * scale;          // Re
+    out[order_ - j] = (b * c + a * d) * scale;  // Im
+  }
+}
+
+void CorrelationEngine::Exec(const int16_t *const *channels) {
+  if (!forward_plan_.Valid() || !inverse_plan_.Valid()) return;
+
+  for (int c = 0; c < channels_; c++) {
+    const int16_t *x = channels[c];
+    float *in = &in_[c * order_];
+    for (int i = 0; i < order_; i++) in[i] = x[i];
+  }
+
+  forward_plan_.Execute(in_, spectra_);
+
+  if (phat_)
+    for (int c = 0; c < channels_; c++) Whiten(&spectra_[c * order_]);
+
+  for (int p = 0; p < int(pairs_.size()); p++)
+    Cross(&cross_[p * order_], &spectra_[pairs_[p].first * order_],
+          &spectra_[pairs_[p].second * order_]);
+
+  if (max_lag_ > 0) {
+    for (int p = 0; p < int(pairs_.size()); p++)
+      EvaluateWindow(&result_[p * order_], &cross_[p * order_]);
+  } else {
+    std::memcpy(inverse_in_, cross_, sizeof(float) * order_ * pairs_.size());
+    inverse_plan_.Execute(inverse_in_, result_);
+  }
+}
+
+};  // namespace matrix_hal
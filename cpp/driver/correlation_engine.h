@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_CORRELATION_ENGINE_H_
+#define CPP_DRIVER_CORRELATION_ENGINE_H_
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include "cpp/driver/fft_planner.h"
+
+namespace matrix_hal {
+
+/*
+Cross-correlation of many channel pairs of one block. Every channel is
+converted and transformed once, in a single batched FFT; each selected pair
+is then a product of two spectra, and all pairs go back to lags in a single
+batched inverse FFT. With PHAT every spectrum is whitened first (GCC-PHAT),
+which leaves only the phase and sharpens the peaks. When only lags close to
+zero matter, a lag window replaces that inverse FFT with the few needed
+lags, evaluated straight from the cross spectra.
+*/
+class CorrelationEngine {
+ public:
+  CorrelationEngine();
+  ~CorrelationEngine();
+
+  // Selects every pair (a, b) with a < b
+  bool Init(int N, int channels);
+  void Release();
+
+  // Pairs to evaluate, replacing the current ones. Pair (a, b) is the
+  // same as CrossCorrelation::Exec(a, b): its peak is at the lag by which
+  // channel a trails channel b.
+  bool SetPairs(const std::vector<std::pair<int, int> > &pairs);
+  void SetPhat(bool phat) { phat_ = phat; }
+
+  // Evaluates only lags in [-|max_lag|, |max_lag|], as sums over the bins,
+  // instead of the full inverse FFT: about N multiply-adds per lag pair, so
+  // cheaper while |max_lag| is below log2(N) or so. Result() is then valid
+  // only at those lags. 0 goes back to every lag.
+  bool SetLagWindow(int max_lag);
+  int LagWindow() { return max_lag_; }
+
+  // |channels|[c] points to N samples of channel c
+  void Exec(const int16_t *const *channels);
+
+  // Correlation of |pair| for the last Exec, lag l at index l mod N
+  float *Result(int pair) { return &result_[pair * order_]; }
+
+  // Lag of a Result index, in (-N/2, N/2]
+  int Lag(int index) { return index <= order_ / 2 ? index : index - order_; }
+
+  // Lag of the highest value of |pair| within [-|max_lag|, |max_lag|],
+  // refined to a fraction of a sample: a parabola through the peak and its
+  // two neighbours, then Newton steps on the correlation between samples,
+  // interpolated from the cross spectrum. |height| gets the peak value.
+  float Peak(int pair, int max_lag, float *height);
+
+  const std::pair<int, int> &Pair(int pair) { return pairs_[pair]; }
+  int Pairs() { return int(pairs_.size()); }
+  int Channels() { return channels_; }
+  int Order() { return order_; }
+
+ private:
+  void Whiten(float *spectrum);
+  void Cross(float *out, const float *x, const float *y);
+  void EvaluateWindow(float *out, const float *x);
+  float Refine(int pair, float lag, float best);
+
+  int order_;
+  int channels_;
+  bool phat_;
+  int max_lag_;
+  std::vector<std::pair<int, int> > pairs_;
+
+  // Channels in time and in frequency (FFTW halfcomplex), N floats each
+  float *in_;
+  float *spectra_;
+  // Cross spectra and their correlations, N floats per pair. The full
+  // inverse runs on a copy of the cross spectra, as it overwrites its
+  // input and Peak still needs them.
+  float *cross_;
+  float *inverse_in_;
+  float *result_;
+  int allocated_pairs_;
+
+  // 2 cos and 2 sin of every bin's phase at lags 0 to max_lag_, the sines
+  // in the order of the imaginary parts of a halfcomplex spectrum
+  std::vector<float> cosine_;
+  std::vector<float> sine_;
+
+  FFTPlan forward_plan_;
+  FFTPlan inverse_plan_;
+};
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_CORRELATION_ENGINE_H_
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "cpp/driver/cpu_features.h"
+
+#if defined(MATRIX_HAL_NEON_KERNEL) && !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace matrix_hal {
+
+bool CpuSupports(CpuFeature feature) {
+  switch (feature) {
+    case kCpuBaseline:
+      return true;
+#if defined(MATRIX_HAL_X86_KERNELS)
+    case kCpuSSE2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse2");
+    case kCpuAVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+#if defined(MATRIX_HAL_NEON_KERNEL)
+    case kCpuNEON:
+#if defined(__aarch64__)
+      return true;
+#else
+      // Built for NEON or not, the CPU may not have it
+      return getauxval(AT_HWCAP) & HWCAP_NEON;
+#endif
+#endif
+    default:
+      return false;
+  }
+}
+
+};  // namespace matrix_hal
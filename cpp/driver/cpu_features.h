@@ -0,0 +1,69 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CPP_DRIVER_CPU_FEATURES_H_
+#define CPP_DRIVER_CPU_FEATURES_H_
+
+// SIMD kernels are each built for their own instruction set with a target
+// attribute, so the files that hold them keep the baseline ISA of the build
+// and only call a kernel after CpuSupports says the CPU can run it.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATRIX_HAL_X86_KERNELS
+#endif
+
+// 32-bit ARM builds such as Raspbian target plain VFP. GCC 8 and later can
+// still compile NEON functions there unless the ABI is soft-float.
+#if defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MATRIX_HAL_NEON_KERNEL
+#define MATRIX_HAL_NEON_TARGET
+#elif defined(__arm__) && defined(__GNUC__) && !defined(__clang__) && \
+    __GNUC__ >= 8 && !defined(__SOFTFP__)
+#define MATRIX_HAL_NEON_KERNEL
+#define MATRIX_HAL_NEON_TARGET __attribute__((target("fpu=neon")))
+#endif
+
+#if defined(MATRIX_HAL_NEON_KERNEL)
+#include <arm_neon.h>
+#endif
+
+namespace matrix_hal {
+
+enum CpuFeature { kCpuBaseline, kCpuSSE2, kCpuAVX2, kCpuNEON };
+
+// Whether the running CPU has |feature|, kCpuBaseline always
+bool CpuSupports(CpuFeature feature);
+
+// First entry of |kernels| the running CPU can run, picked on the first
+// call. Entries have a |feature| member, go from the fastest to the slowest
+// and end with a kCpuBaseline one.
+template <typename Kernel, int kCount>
+const Kernel &SelectKernel(const Kernel (&kernels)[kCount]) {
+  struct Selection {
+    static const Kernel *First(const Kernel *kernel) {
+      while (!CpuSupports(kernel->feature)) kernel++;
+      return kernel;
+    }
+  };
+  static const Kernel *const kernel = Selection::First(kernels);
+  return *kernel;
+}
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_CPU_FEATURES_H_
@@ -26,26 +26,27 @@ CrossCorrelation::CrossCorrelation()
       A_(NULL),
       B_(NULL),
       C_(NULL),
-      c_(NULL),
-      forward_plan_a_(NULL),
-      forward_plan_b_(NULL),
-      inverse_plan_(NULL) {}
+      c_(NULL) {}
 
 CrossCorrelation::~CrossCorrelation() { Release(); }
 
 void CrossCorrelation::Release() {
-  if (forward_plan_a_) fftwf_destroy_plan(forward_plan_a_);
-  if (forward_plan_b_) fftwf_destroy_plan(forward_plan_b_);
-  if (inverse_plan_) fftwf_destroy_plan(inverse_plan_);
+  forward_plan_.Release();
+  inverse_plan_.Release();
 
   if (in_) fftwf_free(in_);
   if (A_) fftwf_free(A_);
   if (B_) fftwf_free(B_);
   if (C_) fftwf_free(C_);
   if (c_) fftwf_free(c_);
+
+  in_ = A_ = B_ = C_ = c_ = NULL;
+  order_ = 0;
 }
 
 bool CrossCorrelation::Init(int N) {
+  // Init again to follow a new block size
+  Release();
   order_ = N;
   /*
   fftwf_malloc function that behave identically to malloc, except that they
@@ -67,38 +68,32 @@ bool CrossCorrelation::Init(int N) {
   c_ = (float *)fftwf_malloc(sizeof(float) * order_);
   if (!c_) return false;
 
-  forward_plan_a_ =
-      fftwf_plan_r2r_1d(order_, in_, A_, FFTW_R2HC, FFTW_ESTIMATE);
-  if (!forward_plan_a_) return false;
-
-  forward_plan_b_ =
-      fftwf_plan_r2r_1d(order_, in_, B_, FFTW_R2HC, FFTW_ESTIMATE);
-  if (!forward_plan_b_) return false;
+  // One forward plan for both channels, run on A_ and then on B_
+  if (!forward_plan_.Init(kFFTRealToHalfcomplex, order_)) return false;
 
-  inverse_plan_ = fftwf_plan_r2r_1d(order_, C_, c_, FFTW_HC2R, FFTW_ESTIMATE);
-  if (!inverse_plan_) return false;
+  if (!inverse_plan_.Init(kFFTHalfcomplexToReal, order_)) return false;
 
   return true;
 }
 
 float *CrossCorrelation::Result() { return c_; }
 
-void CrossCorrelation::Exec(int16_t *a, int16_t *b) {
+void CrossCorrelation::Exec(const int16_t *a, const int16_t *b) {
   for (int i = 0; i < order_; i++) {
     in_[i] = a[i];
   }
 
-  fftwf_execute(forward_plan_a_);
+  forward_plan_.Execute(in_, A_);
 
   for (int i = 0; i < order_; i++) {
     in_[i] = b[i];
   }
 
-  fftwf_execute(forward_plan_b_);
+  forward_plan_.Execute(in_, B_);
 
   Corr(C_, A_, B_);
 
-  fftwf_execute(inverse_plan_);
+  inverse_plan_.Execute(C_, c_);
 
   for (int i = 0; i < order_; i++) {
     c_[i] = c_[i] / order_;
@@ -18,8 +18,8 @@
 #ifndef CPP_CROSS_CORRELATION_H_
 #define CPP_CROSS_CORRELATION_H_
 
-#include <fftw3.h>
 #include <stdint.h>
+#include "cpp/driver/fft_planner.h"
 
 namespace matrix_hal {
 
@@ -32,7 +32,7 @@ class CrossCorrelation {
   ~CrossCorrelation();
   bool Init(int N);
   void Release();
-  void Exec(int16_t *a, int16_t *b);
+  void Exec(const int16_t *a, const int16_t *b);
   float *Result();
 
  private:
@@ -45,9 +45,9 @@ class CrossCorrelation {
   float *C_;
   float *c_;
 
-  fftwf_plan forward_plan_a_;
-  fftwf_plan forward_plan_b_;
-  fftwf_plan inverse_plan_;
+  // Shared with every other correlation of the same size
+  FFTPlan forward_plan_;
+  FFTPlan inverse_plan_;
 };
 
 };      // namespace matrix_hal
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/delay_and_sum.h"
+#include <stdint.h>
+#include <algorithm>
+#include "cpp/driver/cpu_features.h"
+
+namespace matrix_hal {
+
+typedef void (*DelayAndSumFunction)(const int16_t *const *, int, uint32_t,
+                                    int16_t *, uint32_t);
+
+// Sums samples [first, samples), the tail the vector kernels leave over
+static void DelayAndSumScalar(const int16_t *const *channels, int count,
+                              uint32_t samples, int16_t *beam,
+                              uint32_t first) {
+  for (uint32_t s = first; s < samples; s++) {
+    int sum = 0;
+    for (int c = 0; c < count; c++) sum += channels[c][s];
+    beam[s] = std::min(INT16_MAX, std::max(sum, INT16_MIN));
+  }
+}
+
+#if defined(MATRIX_HAL_X86_KERNELS)
+__attribute__((target("sse2"))) static void DelayAndSumSSE2(
+    const int16_t *const *channels, int count, uint32_t samples,
+    int16_t *beam, uint32_t first) {
+  uint32_t s = first;
+  for (; s + 8 <= samples; s += 8) {
+    __m128i low = _mm_setzero_si128();
+    __m128i high = _mm_setzero_si128();
+    for (int c = 0; c < count; c++) {
+      __m128i x =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(channels[c] + s));
+      // Sign extend to 32 bits by unpacking each sample with itself
+      low = _mm_add_epi32(low, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+      high = _mm_add_epi32(high, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(beam + s),
+                     _mm_packs_epi32(low, high));
+  }
+  DelayAndSumScalar(channels, count, samples, beam, s);
+}
+
+__attribute__((target("avx2"))) static void DelayAndSumAVX2(
+    const int16_t *const *channels, int count, uint32_t samples,
+    int16_t *beam, uint32_t first) {
+  uint32_t s = first;
+  for (; s + 16 <= samples; s += 16) {
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    for (int c = 0; c < count; c++) {
+      __m256i x = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(channels[c] + s));
+      low = _mm256_add_epi32(low,
+                             _mm256_cvtepi16_epi32(_mm256_castsi256_si128(x)));
+      high = _mm256_add_epi32(
+          high, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1)));
+    }
+    // packs works per 128-bit lane, put the four 64-bit quarters back in
+    // sample order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high),
+                                              0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(beam + s), packed);
+  }
+  DelayAndSumSSE2(channels, count, samples, beam, s);
+}
+#endif
+
+#if defined(MATRIX_HAL_NEON_KERNEL)
+MATRIX_HAL_NEON_TARGET static void DelayAndSumNEON(
+    const int16_t *const *channels, int count, uint32_t samples,
+    int16_t *beam, uint32_t first) {
+  uint32_t s = first;
+  for (; s + 8 <= samples; s += 8) {
+    int32x4_t low = vdupq_n_s32(0);
+    int32x4_t high = vdupq_n_s32(0);
+    for (int c = 0; c < count; c++) {
+      int16x8_t x = vld1q_s16(channels[c] + s);
+      low = vaddw_s16(low, vget_low_s16(x));
+      high = vaddw_s16(high, vget_high_s16(x));
+    }
+    vst1q_s16(beam + s, vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+  }
+  DelayAndSumScalar(channels, count, samples, beam, s);
+}
+#endif
+
+struct DelayAndSumKernelEntry {
+  CpuFeature feature;
+  DelayAndSumFunction function;
+  const char *name;
+};
+
+static const DelayAndSumKernelEntry kKernels[] = {
+#if defined(MATRIX_HAL_X86_KERNELS)
+    {kCpuAVX2, &DelayAndSumAVX2, "avx2"},
+    {kCpuSSE2, &DelayAndSumSSE2, "sse2"},
+#endif
+#if defined(MATRIX_HAL_NEON_KERNEL)
+    {kCpuNEON, &DelayAndSumNEON, "neon"},
+#endif
+    {kCpuBaseline, &DelayAndSumScalar, "scalar"}};
+
+void DelayAndSum(const int16_t *const *channels, int count, uint32_t samples,
+                 int16_t *beam) {
+  SelectKernel(kKernels).function(channels, count, samples, beam, 0);
+}
+
+const char *DelayAndSumKernel() { return SelectKernel(kKernels).name; }
+};  // namespace matrix_hal
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_DELAY_AND_SUM_H_
+#define CPP_DRIVER_DELAY_AND_SUM_H_
+
+#include <stdint.h>
+
+namespace matrix_hal {
+
+// beam[s] = sum of channels[c][s] over |count| channels, saturated to
+// int16. Channels are summed in 32 bits, so only the result saturates.
+// The fastest kernel for the running CPU (AVX2, SSE2, NEON or scalar) is
+// picked on first use.
+void DelayAndSum(const int16_t *const *channels, int count, uint32_t samples,
+                 int16_t *beam);
+
+// Name of the kernel DelayAndSum runs on this CPU
+const char *DelayAndSumKernel();
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_DELAY_AND_SUM_H_
@@ -15,35 +15,120 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cmath>
 #include <map>
 #include <string>
 
-#include "cpp/driver/cross_correlation.h"
+#include "cpp/driver/correlation_engine.h"
 #include "cpp/driver/direction_of_arrival.h"
 #include "cpp/driver/microphone_array_location.h"
+#include "cpp/driver/srp_phat.h"
 
 namespace matrix_hal {
 
-DirectionOfArrival::DirectionOfArrival(MicrophoneArray &mics) : mics_(mics) {}
+// Speed of sound used to bound the pair delays, in mm/s
+static const float kDoaSoundSpeedMmSeg = 343 * 1000.0;
+
+// Max delay in samples between microphones of an opposite pair
+static const int kDoaMaxTof = 6;
+
+// Plane wave lags of pair (a, b) per unit of direction: a wave from unit
+// direction u reaches microphone m p_m . u / c seconds early, so the pair
+// peaks at lag hx * ux + hy * uy
+static void PairLags(const float (*geometry)[2], int a, int b,
+                     float samples_per_mm, float *hx, float *hy) {
+  *hx = -(geometry[a][0] - geometry[b][0]) * samples_per_mm;
+  *hy = -(geometry[a][1] - geometry[b][1]) * samples_per_mm;
+}
+
+DirectionOfArrival::DirectionOfArrival(MicrophoneArray &mics)
+    : mics_(mics),
+      length_(0),
+      sampling_rate_(0),
+      method_(kDoaOppositePairs),
+      configured_(false),
+      threads_(1),
+      corr_(NULL),
+      srp_(NULL) {}
+
+DirectionOfArrival::~DirectionOfArrival() {
+  delete corr_;
+  delete srp_;
+}
+
+void DirectionOfArrival::SetMethod(DoaMethod method) {
+  if (method != method_) configured_ = false;
+  method_ = method;
+}
+
+void DirectionOfArrival::SetThreads(int threads) {
+  threads_ = threads < 1 ? 1 : threads;
+  if (srp_) srp_->SetThreads(threads_);
+}
 
 bool DirectionOfArrival::Init() {
   length_ = mics_.NumberOfSamples();
-  corr_ = new CrossCorrelation();
-  corr_->Init(mics_.NumberOfSamples());
+  sampling_rate_ = mics_.SamplingRate();
+  configured_ = false;
   current_mag_.resize(4);
   current_index_.resize(4);
-  buffer_1D_.resize(mics_.Channels() * mics_.NumberOfSamples());
-  buffer_2D_.resize(mics_.Channels());
   mic_direction_ = 0;
   azimutal_angle_ = 0;
   polar_angle_ = 0;
-  for (uint16_t c = 0; c < mics_.Channels(); c++) {
-    buffer_2D_[c] = &buffer_1D_[c * mics_.NumberOfSamples()];
+
+  if (method_ == kDoaSrpPhat) {
+    if (!srp_) {
+      srp_ = new SrpPhat();
+      srp_->SetThreads(threads_);
+    }
+    if (!srp_->Init(length_, mics_.Channels(), mics_.Geometry(),
+                    sampling_rate_, 24, 4, kDoaSoundSpeedMmSeg))
+      return false;
+    configured_ = true;
+    return true;
+  }
+
+  if (!corr_) corr_ = new CorrelationEngine();
+  if (!corr_->Init(mics_.NumberOfSamples(), mics_.Channels())) return false;
+
+  if (method_ == kDoaOppositePairs) {
+    // Only the pairs the peak search below uses, each channel against the
+    // one across the array
+    std::vector<std::pair<int, int> > pairs;
+    for (int channel = 0; channel < 4; channel++)
+      pairs.push_back(std::make_pair(channel + 4, channel));
+    if (!corr_->SetPairs(pairs)) return false;
+    corr_->SetPhat(false);
+    // The peak search never looks further, nor past half a short block
+    if (!corr_->SetLagWindow(std::min(kDoaMaxTof, length_ / 2 - 1)))
+      return false;
+  } else {
+    corr_->SetPhat(true);
+    // The longest lag of any pair, and one more for the interpolation
+    if (!corr_->SetLagWindow(std::min(MaxPairLag() + 1, length_ / 2 - 1)))
+      return false;
   }
+  configured_ = true;
   return true;
 }
 
+int DirectionOfArrival::MaxPairLag(int pair) {
+  float hx, hy;
+  PairLags(mics_.Geometry(), corr_->Pair(pair).first, corr_->Pair(pair).second,
+           float(sampling_rate_) / kDoaSoundSpeedMmSeg, &hx, &hy);
+  // Lags a plane wave can produce for this pair, plus one
+  int max_lag = int(std::ceil(std::sqrt(hx * hx + hy * hy))) + 1;
+  return std::min(max_lag, length_ / 2 - 1);
+}
+
+int DirectionOfArrival::MaxPairLag() {
+  int max_lag = 0;
+  for (int p = 0; p < corr_->Pairs(); p++)
+    max_lag = std::max(max_lag, MaxPairLag(p));
+  return max_lag;
+}
+
 int DirectionOfArrival::getAbsDiff(int index) {
   if (index < length_ / 2) {
     return index;
@@ -52,23 +137,50 @@ int DirectionOfArrival::getAbsDiff(int index) {
 }
 
 void DirectionOfArrival::Calculate() {
-  // Max delay in samples between microphones of a pair
-  int max_tof = 6;
-
-  // Prepare buffer for cross correlation calculation between the microphones of
-  // a pair
-  for (uint32_t s = 0; s < mics_.NumberOfSamples(); s++) {
-    for (uint16_t c = 0; c < mics_.Channels(); c++) { /* mics_.Channels()=8 */
-      buffer_2D_[c][s] = mics_.At(s, c);
+  // Follow MicrophoneArray::SetBlockSize, SetSamplingRate and SetMethod
+  if ((length_ != int(mics_.NumberOfSamples()) ||
+       sampling_rate_ != mics_.SamplingRate() || !configured_) &&
+      !Init())
+    return;
+
+  const int16_t *channels[kMicrophoneChannels];
+  for (int c = 0; c < mics_.Channels(); c++) channels[c] = mics_.Channel(c);
+
+  if (method_ == kDoaSrpPhat) {
+    srp_->Exec(channels);
+    azimutal_angle_ = srp_->AzimutalAngle();
+    polar_angle_ = srp_->PolarAngle();
+    NearestMicrophone(std::cos(azimutal_angle_), std::sin(azimutal_angle_));
+    return;
+  }
+
+  corr_->Exec(channels);
+  if (method_ == kDoaOppositePairs)
+    CalculateOppositePairs();
+  else
+    CalculateLeastSquares();
+}
+
+void DirectionOfArrival::NearestMicrophone(float ux, float uy) {
+  // Microphone that points most towards the source
+  const float (*geometry)[2] = mics_.Geometry();
+  float best = -1e30f;
+  for (int m = 0; m < mics_.Channels(); m++) {
+    float along = geometry[m][0] * ux + geometry[m][1] * uy;
+    if (along > best) {
+      best = along;
+      mic_direction_ = m;
     }
   }
+}
+
+void DirectionOfArrival::CalculateOppositePairs() {
+  // The lag window of Init
+  const int max_tof = std::min(kDoaMaxTof, length_ / 2 - 1);
 
   // Loop over each microphone pair
   for (int channel = 0; channel < 4; channel++) {
-    // Calculate the cross correlation
-    corr_->Exec(buffer_2D_[channel + 4], buffer_2D_[channel]);
-
-    float *c = corr_->Result();
+    float *c = corr_->Result(channel);
 
     // Find the sample index of the highest peak (beginning of the window)
     int index = 0;
@@ -121,4 +233,40 @@ void DirectionOfArrival::Calculate() {
   polar_angle_ = fabs(index) * M_PI / 2.0 / float(max_tof - 1);
 }
 
+void DirectionOfArrival::CalculateLeastSquares() {
+  const float (*geometry)[2] = mics_.Geometry();
+  const float samples_per_mm = float(sampling_rate_) / kDoaSoundSpeedMmSeg;
+
+  // Each pair adds its plane wave row, weighted by its peak height, to the
+  // normal equations of u = (ux, uy). The peak lags are fractional, so the
+  // fit is not limited to whole samples of delay.
+  float sxx = 0, sxy = 0, syy = 0, bx = 0, by = 0;
+  for (int p = 0; p < corr_->Pairs(); p++) {
+    float hx, hy;
+    PairLags(geometry, corr_->Pair(p).first, corr_->Pair(p).second,
+             samples_per_mm, &hx, &hy);
+
+    float peak;
+    const float best_lag = corr_->Peak(p, MaxPairLag(p), &peak);
+    if (peak <= 0) continue;
+
+    sxx += peak * hx * hx;
+    sxy += peak * hx * hy;
+    syy += peak * hy * hy;
+    bx += peak * hx * best_lag;
+    by += peak * hy * best_lag;
+  }
+
+  const float det = sxx * syy - sxy * sxy;
+  if (std::fabs(det) < 1e-12f) return;  // keep the last estimate
+  const float ux = (syy * bx - sxy * by) / det;
+  const float uy = (sxx * by - sxy * bx) / det;
+
+  azimutal_angle_ = atan2(uy, ux);
+  // The in-plane part of u is sin of the angle from the array's normal
+  float horizontal = std::sqrt(ux * ux + uy * uy);
+  polar_angle_ = asin(horizontal < 1.0f ? horizontal : 1.0f);
+  NearestMicrophone(ux, uy);
+}
+
 };  // namespace matrix_hal
@@ -21,16 +21,34 @@
 #include <string>
 #include <valarray>
 
-#include "./cross_correlation.h"
+#include "./correlation_engine.h"
 #include "./microphone_array.h"
 
 namespace matrix_hal {
 
+enum DoaMethod {
+  // Peaks of the four opposite pairs; picks the nearest microphone
+  kDoaOppositePairs,
+  // GCC-PHAT delays of all 28 pairs fitted to a plane wave by least squares
+  kDoaLeastSquares,
+  // Steered response power over a grid of directions, see SrpPhat
+  kDoaSrpPhat
+};
+
+class SrpPhat;
+
 class DirectionOfArrival {
  public:
   DirectionOfArrival(MicrophoneArray &mics);
+  ~DirectionOfArrival();
   bool Init();
 
+  // Takes effect on the next Init or Calculate
+  void SetMethod(DoaMethod method);
+
+  // Threads that share the direction search of kDoaSrpPhat
+  void SetThreads(int threads);
+
   void Calculate();
 
   float GetAzimutalAngle() { return azimutal_angle_; }
@@ -40,13 +58,22 @@ class DirectionOfArrival {
  private:
   MicrophoneArray &mics_;
   int length_;
-  CrossCorrelation *corr_;
+  uint32_t sampling_rate_;
+  DoaMethod method_;
+  bool configured_;
+  int threads_;
+  CorrelationEngine *corr_;
+  SrpPhat *srp_;
   std::valarray<float> current_mag_;
   std::valarray<float> current_index_;
-  std::valarray<int16_t> buffer_1D_;
-  std::valarray<int16_t *> buffer_2D_;
 
   int getAbsDiff(int index);
+  // Longest lag a plane wave gives |pair|, plus one; and over all pairs
+  int MaxPairLag(int pair);
+  int MaxPairLag();
+  void CalculateOppositePairs();
+  void CalculateLeastSquares();
+  void NearestMicrophone(float ux, float uy);
 
   uint16_t mic_direction_;
   float azimutal_angle_;
@@ -27,20 +27,38 @@ namespace matrix_hal {
 
 Everloop::Everloop() {}
 
-bool Everloop::Write(const EverloopImage *led_image) {
-  if (!bus_) return false;
-
-  std::valarray<unsigned char> write_data(led_image->leds.size() * 4);
+void Everloop::Pack(const EverloopImage *led_image) {
+  if (write_data_.size() != led_image->leds.size() * 4)
+    write_data_.resize(led_image->leds.size() * 4);
 
   uint32_t led_offset = 0;
   for (const LedValue &led : led_image->leds) {
-    write_data[led_offset + 0] = led.red;
-    write_data[led_offset + 1] = led.green;
-    write_data[led_offset + 2] = led.blue;
-    write_data[led_offset + 3] = led.white;
+    write_data_[led_offset + 0] = led.red;
+    write_data_[led_offset + 1] = led.green;
+    write_data_[led_offset + 2] = led.blue;
+    write_data_[led_offset + 3] = led.white;
     led_offset += 4;
   }
-  bus_->Write(kEverloopBaseAddress, &write_data[0], write_data.size());
+}
+
+bool Everloop::Write(const EverloopImage *led_image) {
+  if (!bus_) return false;
+
+  Pack(led_image);
+  bus_->Write(kEverloopBaseAddress, &write_data_[0], write_data_.size());
   return true;
 }
+
+std::future<bool> Everloop::WriteAsync(const EverloopImage *led_image) {
+  if (!bus_) {
+    std::promise<bool> failed;
+    failed.set_value(false);
+    return failed.get_future();
+  }
+
+  // The bus copies the frame, write_data_ is free again on return
+  Pack(led_image);
+  return bus_->WriteAsync(kEverloopBaseAddress, &write_data_[0],
+                          write_data_.size());
+}
 };  // namespace matrix_hal
@@ -18,7 +18,9 @@
 #ifndef CPP_DRIVER_EVERLOOP_H_
 #define CPP_DRIVER_EVERLOOP_H_
 
+#include <future>
 #include <string>
+#include <valarray>
 #include "./everloop_image.h"
 #include "./matrix_driver.h"
 
@@ -28,6 +30,13 @@ class Everloop : public MatrixDriver {
  public:
   Everloop();
   bool Write(const EverloopImage *led_image);
+  // Queues the frame on the bus I/O thread and returns at once
+  std::future<bool> WriteAsync(const EverloopImage *led_image);
+
+ private:
+  void Pack(const EverloopImage *led_image);
+
+  std::valarray<unsigned char> write_data_;
 };
 };      // namespace matrix_hal
 #endif  // CPP_DRIVER_EVERLOOP_H_
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/fft_planner.h"
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace matrix_hal {
+
+// type, n, howmany, input distance, output distance, effort
+typedef std::tuple<int, int, int, int, int, int> PlanKey;
+
+struct SharedFFTPlan {
+  PlanKey key;
+  fftwf_plan plan;
+  int users;
+};
+
+namespace {
+
+struct Planner {
+  Planner() : effort(kFFTEstimate) {}
+
+  // Guards everything below and every call into the FFTW planner
+  std::mutex mutex;
+  FFTPlanEffort effort;
+  std::string wisdom_file;
+  std::map<PlanKey, SharedFFTPlan *> plans;
+};
+
+// Never destroyed, so plans released by static objects at exit still find
+// it
+Planner &GetPlanner() {
+  static Planner *planner = new Planner();
+  return *planner;
+}
+
+unsigned EffortFlags(FFTPlanEffort effort) {
+  switch (effort) {
+    case kFFTMeasure:
+      return FFTW_MEASURE;
+    case kFFTPatient:
+      return FFTW_PATIENT;
+    default:
+      return FFTW_ESTIMATE;
+  }
+}
+
+bool ComplexInput(FFTPlanType type) { return type == kFFTComplexToReal; }
+bool ComplexOutput(FFTPlanType type) { return type == kFFTRealToComplex; }
+
+// Length of one transform in elements of its array
+int InLength(FFTPlanType type, int n) {
+  return ComplexInput(type) ? n / 2 + 1 : n;
+}
+int OutLength(FFTPlanType type, int n) {
+  return ComplexOutput(type) ? n / 2 + 1 : n;
+}
+
+// Called with the planner locked. Measuring overwrites the arrays, so the
+// plan is made on scratch ones with the caller's layout.
+fftwf_plan MakePlan(FFTPlanType type, int n, int howmany, int in_distance,
+                    int out_distance, FFTPlanEffort effort) {
+  const size_t in_bytes =
+      (size_t(howmany - 1) * in_distance + InLength(type, n)) *
+      (ComplexInput(type) ? sizeof(fftwf_complex) : sizeof(float));
+  const size_t out_bytes =
+      (size_t(howmany - 1) * out_distance + OutLength(type, n)) *
+      (ComplexOutput(type) ? sizeof(fftwf_complex) : sizeof(float));
+
+  void *in = fftwf_malloc(in_bytes);
+  void *out = fftwf_malloc(out_bytes);
+  fftwf_plan plan = NULL;
+
+  if (in && out) {
+    fftwf_iodim dim;
+    dim.n = n;
+    dim.is = 1;
+    dim.os = 1;
+
+    fftwf_iodim batch;
+    batch.n = howmany;
+    batch.is = in_distance;
+    batch.os = out_distance;
+
+    const unsigned flags = EffortFlags(effort);
+    fftwf_r2r_kind kind = FFTW_R2HC;
+    switch (type) {
+      case kFFTHalfcomplexToReal:
+        kind = FFTW_HC2R;
+      // Fall through
+      case kFFTRealToHalfcomplex:
+        plan = fftwf_plan_guru_r2r(1, &dim, 1, &batch, (float *)in,
+                                   (float *)out, &kind, flags);
+        break;
+      case kFFTRealToComplex:
+        plan = fftwf_plan_guru_dft_r2c(1, &dim, 1, &batch, (float *)in,
+                                       (fftwf_complex *)out, flags);
+        break;
+      case kFFTComplexToReal:
+        plan = fftwf_plan_guru_dft_c2r(1, &dim, 1, &batch,
+                                       (fftwf_complex *)in, (float *)out,
+                                       flags);
+        break;
+    }
+  }
+
+  if (in) fftwf_free(in);
+  if (out) fftwf_free(out);
+  return plan;
+}
+
+// Called with the planner locked. Written beside the file and renamed over
+// it, so a service killed halfway leaves the previous wisdom intact.
+bool WriteWisdom(const std::string &path) {
+  if (path.empty()) return true;
+  const std::string partial = path + ".tmp";
+  if (!fftwf_export_wisdom_to_filename(partial.c_str()) ||
+      std::rename(partial.c_str(), path.c_str()) != 0) {
+    std::cerr << "FFT: can't write the wisdom file " << path << std::endl;
+    std::remove(partial.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+void SetFFTPlanEffort(FFTPlanEffort effort) {
+  Planner &planner = GetPlanner();
+  std::lock_guard<std::mutex> lock(planner.mutex);
+  planner.effort = effort;
+}
+
+FFTPlanEffort GetFFTPlanEffort() {
+  Planner &planner = GetPlanner();
+  std::lock_guard<std::mutex> lock(planner.mutex);
+  return planner.effort;
+}
+
+bool ParseFFTPlanEffort(const std::string &name, FFTPlanEffort *effort) {
+  if (name == "estimate")
+    *effort = kFFTEstimate;
+  else if (name == "measure")
+    *effort = kFFTMeasure;
+  else if (name == "patient")
+    *effort = kFFTPatient;
+  else
+    return false;
+  return true;
+}
+
+bool SetFFTWisdomFile(const std::string &path) {
+  Planner &planner = GetPlanner();
+  std::lock_guard<std::mutex> lock(planner.mutex);
+  planner.wisdom_file = path;
+  if (path.empty() || access(path.c_str(), F_OK) != 0) return true;
+
+  if (!fftwf_import_wisdom_from_filename(path.c_str())) {
+    std::cerr << "FFT: can't read the wisdom file " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ExportFFTWisdom() {
+  Planner &planner = GetPlanner();
+  std::lock_guard<std::mutex> lock(planner.mutex);
+  return WriteWisdom(planner.wisdom_file);
+}
+
+FFTPlan::FFTPlan() : shared_(NULL), plan_(NULL) {}
+
+FFTPlan::~FFTPlan() { Release(); }
+
+bool FFTPlan::Init(FFTPlanType type, int n, int howmany, int in_distance,
+                   int out_distance) {
+  Release();
+  if (n < 1 || howmany < 1 || in_distance < 0 || out_distance < 0)
+    return false;
+  if (in_distance == 0) in_distance = InLength(type, n);
+  if (out_distance == 0) out_distance = OutLength(type, n);
+
+  Planner &planner = GetPlanner();
+  std::lock_guard<std::mutex> lock(planner.mutex);
+
+  const PlanKey key(type, n, howmany, in_distance, out_distance,
+                    planner.effort);
+  std::map<PlanKey, SharedFFTPlan *>::iterator found = planner.plans.find(key);
+  if (found != planner.plans.end()) {
+    shared_ = found->second;
+  } else {
+    fftwf_plan plan = MakePlan(type, n, howmany, in_distance, out_distance,
+                               planner.effort);
+    if (!plan) return false;
+
+    shared_ = new SharedFFTPlan();
+    shared_->key = key;
+    shared_->plan = plan;
+    shared_->users = 0;
+    planner.plans[key] = shared_;
+
+    // Estimates are instant to make again, only measured plans are saved
+    if (planner.effort != kFFTEstimate) WriteWisdom(planner.wisdom_file);
+  }
+
+  shared_->users++;
+  plan_ = shared_->plan;
+  return true;
+}
+
+void FFTPlan::Release() {
+  if (!shared_) return;
+
+  Planner &planner = GetPlanner();
+  std::lock_guard<std::mutex> lock(planner.mutex);
+  if (--shared_->users == 0) {
+    fftwf_destroy_plan(shared_->plan);
+    planner.plans.erase(shared_->key);
+    delete shared_;
+  }
+  shared_ = NULL;
+  plan_ = NULL;
+}
+
+void FFTPlan::Execute(float *in, float *out) const {
+  fftwf_execute_r2r(plan_, in, out);
+}
+
+void FFTPlan::Execute(float *in, fftwf_complex *out) const {
+  fftwf_execute_dft_r2c(plan_, in, out);
+}
+
+void FFTPlan::Execute(fftwf_complex *in, float *out) const {
+  fftwf_execute_dft_c2r(plan_, in, out);
+}
+
+};  // namespace matrix_hal
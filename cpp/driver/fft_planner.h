@@ -0,0 +1,96 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_FFT_PLANNER_H_
+#define CPP_DRIVER_FFT_PLANNER_H_
+
+#include <fftw3.h>
+#include <string>
+
+namespace matrix_hal {
+
+// How long FFTW may spend looking for the fastest algorithm of a plan
+enum FFTPlanEffort {
+  kFFTEstimate,  // heuristics only, instant; the default
+  kFFTMeasure,   // times a few algorithms, up to seconds per new size
+  kFFTPatient    // times many more, up to minutes per new size
+};
+
+// Effort of the plans made from now on, for the whole process
+void SetFFTPlanEffort(FFTPlanEffort effort);
+FFTPlanEffort GetFFTPlanEffort();
+
+// Accepts "estimate", "measure" and "patient"
+bool ParseFFTPlanEffort(const std::string &name, FFTPlanEffort *effort);
+
+// Wisdom file of the process. It is imported here if it exists, and
+// written again each time a measured plan is made, so the next start
+// plans every known size without measuring. False if it exists but can't
+// be read. An empty |path| stops using a file.
+bool SetFFTWisdomFile(const std::string &path);
+
+// Writes the wisdom gathered so far to the file, if one is set
+bool ExportFFTWisdom();
+
+enum FFTPlanType {
+  kFFTRealToHalfcomplex,  // FFTW_R2HC, N floats to N floats
+  kFFTHalfcomplexToReal,  // FFTW_HC2R, N floats to N floats
+  kFFTRealToComplex,      // N floats to N / 2 + 1 fftwf_complex
+  kFFTComplexToReal       // N / 2 + 1 fftwf_complex to N floats
+};
+
+struct SharedFFTPlan;
+
+/*
+Handle to an FFTW plan shared by every FFTPlan of the same type, size,
+layout and effort in the process. Plans are made on scratch arrays under a
+global lock, since the FFTW planner is not thread safe, and run with the
+new-array execute functions on the caller's arrays, which is. All
+transforms are out of place; the arrays must come from fftwf_malloc, like
+the scratch ones, so they have the alignment the plan expects.
+*/
+class FFTPlan {
+ public:
+  FFTPlan();
+  ~FFTPlan();
+
+  // |howmany| transforms of size |n| in one call (through the guru
+  // interface); transform i reads at in + i * |in_distance| and writes at
+  // out + i * |out_distance|, counted in elements of each array. A
+  // distance of 0 packs the transforms one after another.
+  bool Init(FFTPlanType type, int n, int howmany = 1, int in_distance = 0,
+            int out_distance = 0);
+  void Release();
+  bool Valid() const { return plan_ != NULL; }
+
+  // The overload must match the type given to Init. A halfcomplex to real
+  // transform overwrites |in|, as FFTW's does by default.
+  void Execute(float *in, float *out) const;
+  void Execute(float *in, fftwf_complex *out) const;
+  // Overwrites |in|, as every complex to real FFTW transform does
+  void Execute(fftwf_complex *in, float *out) const;
+
+ private:
+  FFTPlan(const FFTPlan &);
+  FFTPlan &operator=(const FFTPlan &);
+
+  SharedFFTPlan *shared_;
+  fftwf_plan plan_;
+};
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_FFT_PLANNER_H_
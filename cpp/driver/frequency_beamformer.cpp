@@ -0,0 +1,244 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/frequency_beamformer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "cpp/driver/beam_steering.h"
+
+namespace matrix_hal {
+
+static const double kPi = 3.14159265358979323846;
+
+FrequencyBeamformer::FrequencyBeamformer()
+    : order_(0),
+      channels_(0),
+      beams_count_(0),
+      first_bin_(0),
+      last_bin_(0),
+      samples_(0),
+      in_(NULL),
+      spectrum_(NULL),
+      out_(NULL) {}
+
+FrequencyBeamformer::~FrequencyBeamformer() { Release(); }
+
+void FrequencyBeamformer::Release() {
+  forward_plan_.Release();
+  inverse_plan_.Release();
+
+  if (in_) fftwf_free(in_);
+  if (spectrum_) fftwf_free(spectrum_);
+  if (out_) fftwf_free(out_);
+
+  in_ = out_ = NULL;
+  spectrum_ = NULL;
+}
+
+bool FrequencyBeamformer::Init(int N, int channels, int beams) {
+  Release();
+  if (N < 4 || (N & (N - 1)) || channels < 1 || beams < 1) return false;
+
+  order_ = N;
+  channels_ = channels;
+  beams_count_ = beams;
+  first_bin_ = 0;
+  last_bin_ = Bins() - 1;
+  samples_ = 0;
+
+  in_ = (float *)fftwf_malloc(sizeof(float) * order_ * channels_);
+  if (!in_) return false;
+
+  spectrum_ = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * Bins() *
+                                            channels_);
+  if (!spectrum_) return false;
+
+  out_ = (float *)fftwf_malloc(sizeof(float) * order_);
+  if (!out_) return false;
+
+  if (!forward_plan_.Init(kFFTRealToComplex, order_, channels_)) return false;
+
+  if (!inverse_plan_.Init(kFFTComplexToReal, order_)) return false;
+
+  // Periodic sqrt-Hann on analysis and synthesis: the squares of two frames
+  // half a frame apart add up to one
+  window_.resize(order_);
+  for (int n = 0; n < order_; n++)
+    window_[n] = float(std::sqrt(0.5 - 0.5 * std::cos(2 * kPi * n / order_)));
+
+  history_.assign(channels_ * order_, 0.0f);
+  real_.assign(channels_ * Bins(), 0.0f);
+  imag_.assign(channels_ * Bins(), 0.0f);
+  weight_real_.assign(beams_count_ * channels_ * Bins(), 0.0f);
+  weight_imag_.assign(beams_count_ * channels_ * Bins(), 0.0f);
+  beam_real_.assign(Bins(), 0.0f);
+  beam_imag_.assign(Bins(), 0.0f);
+  overlap_.assign(beams_count_ * Hop(), 0.0f);
+  output_.assign(beams_count_, 1);
+  power_.assign(beams_count_, 0.0f);
+  beams_.clear();
+
+  std::vector<float> delays(channels_, 0.0f);
+  for (int b = 0; b < beams_count_; b++) SetBeam(b, delays.data());
+
+  return true;
+}
+
+void FrequencyBeamformer::SetBeam(int beam, const float *delays) {
+  if (beam < 0 || beam >= beams_count_) return;
+
+  // A delay of d samples is a phase of -2 pi k d / N at bin k
+  for (int c = 0; c < channels_; c++) {
+    float *wr = &weight_real_[Bins() * (beam * channels_ + c)];
+    float *wi = &weight_imag_[Bins() * (beam * channels_ + c)];
+    for (int k = 0; k < Bins(); k++) {
+      double phase = -2 * kPi * k * delays[c] / order_;
+      wr[k] = float(std::cos(phase) / channels_);
+      wi[k] = float(std::sin(phase) / channels_);
+    }
+  }
+}
+
+void FrequencyBeamformer::SetBeam(int beam, const float (*geometry)[2],
+                                  uint32_t sampling_frequency,
+                                  float azimutal_angle, float polar_angle,
+                                  float radial_distance_mm,
+                                  float sound_speed_mmseg) {
+  if (channels_ > kSteeringChannels || sound_speed_mmseg == 0) return;
+
+  float delays[kSteeringChannels];
+  SteeringTable::Delays(geometry, sampling_frequency, azimutal_angle,
+                        polar_angle, radial_distance_mm, sound_speed_mmseg,
+                        delays);
+  SetBeam(beam, delays);
+}
+
+void FrequencyBeamformer::SetBand(int first_bin, int last_bin) {
+  first_bin_ = std::min(std::max(first_bin, 0), Bins() - 1);
+  last_bin_ = std::min(std::max(last_bin, first_bin_), Bins() - 1);
+}
+
+void FrequencyBeamformer::SetOutput(int beam, bool output) {
+  if (beam < 0 || beam >= beams_count_) return;
+  // A beam that was not synthesized has no valid overlap-add tail
+  if (output && !output_[beam])
+    std::fill(&overlap_[beam * Hop()], &overlap_[(beam + 1) * Hop()], 0.0f);
+  output_[beam] = output;
+}
+
+int FrequencyBeamformer::Loudest() {
+  if (power_.empty()) return -1;
+  return int(std::max_element(power_.begin(), power_.end()) - power_.begin());
+}
+
+void FrequencyBeamformer::Analyze(const int16_t *input, uint32_t samples,
+                                  uint32_t offset) {
+  const int hop = Hop();
+  for (int c = 0; c < channels_; c++) {
+    float *history = &history_[c * order_];
+    const int16_t *x = &input[c * samples + offset];
+
+    std::memmove(history, history + hop, sizeof(float) * hop);
+    for (int n = 0; n < hop; n++) history[hop + n] = x[n];
+
+    float *in = &in_[c * order_];
+    for (int n = 0; n < order_; n++) in[n] = history[n] * window_[n];
+  }
+
+  forward_plan_.Execute(in_, spectrum_);
+
+  for (int c = 0; c < channels_; c++) {
+    const fftwf_complex *spectrum = &spectrum_[c * Bins()];
+    float *xr = &real_[c * Bins()];
+    float *xi = &imag_[c * Bins()];
+    for (int k = 0; k < Bins(); k++) {
+      xr[k] = spectrum[k][0];
+      xi[k] = spectrum[k][1];
+    }
+  }
+}
+
+void FrequencyBeamformer::Synthesize(int beam, int16_t *out) {
+  const int hop = Hop();
+  std::memset(reinterpret_cast<void *>(spectrum_), 0,
+              sizeof(fftwf_complex) * Bins());
+  for (int k = first_bin_; k <= last_bin_; k++) {
+    spectrum_[k][0] = beam_real_[k];
+    spectrum_[k][1] = beam_imag_[k];
+  }
+
+  inverse_plan_.Execute(spectrum_, out_);
+
+  // FFTW leaves the inverse scaled by N
+  const float scale = 1.0f / order_;
+  float *overlap = &overlap_[beam * hop];
+  for (int n = 0; n < hop; n++) {
+    float value = out_[n] * window_[n] * scale + overlap[n];
+    value = std::min(std::max(value, -32768.0f), 32767.0f);
+    out[n] = int16_t(std::lrint(value));
+    overlap[n] = out_[hop + n] * window_[hop + n] * scale;
+  }
+}
+
+bool FrequencyBeamformer::Exec(const int16_t *input, uint32_t samples) {
+  const int hop = Hop();
+  if (!forward_plan_.Valid() || samples == 0 || samples % hop) return false;
+
+  if (samples != samples_) {
+    samples_ = samples;
+    beams_.assign(beams_count_ * samples_, 0);
+  }
+  std::fill(power_.begin(), power_.end(), 0.0f);
+
+  const uint32_t hops = samples / hop;
+  for (uint32_t h = 0; h < hops; h++) {
+    Analyze(input, samples, h * hop);
+
+    for (int b = 0; b < beams_count_; b++) {
+      float *yr = beam_real_.data();
+      float *yi = beam_imag_.data();
+      std::fill(yr + first_bin_, yr + last_bin_ + 1, 0.0f);
+      std::fill(yi + first_bin_, yi + last_bin_ + 1, 0.0f);
+
+      // The only work that grows with the number of beams besides Synthesize
+      for (int c = 0; c < channels_; c++) {
+        const float *wr = &weight_real_[Bins() * (b * channels_ + c)];
+        const float *wi = &weight_imag_[Bins() * (b * channels_ + c)];
+        const float *xr = &real_[c * Bins()];
+        const float *xi = &imag_[c * Bins()];
+        for (int k = first_bin_; k <= last_bin_; k++) {
+          yr[k] += wr[k] * xr[k] - wi[k] * xi[k];
+          yi[k] += wr[k] * xi[k] + wi[k] * xr[k];
+        }
+      }
+
+      // Parseval, counting the mirrored half of the spectrum
+      float energy = 0;
+      for (int k = first_bin_; k <= last_bin_; k++) {
+        float bin = yr[k] * yr[k] + yi[k] * yi[k];
+        energy += (k == 0 || k == order_ / 2) ? bin : 2 * bin;
+      }
+      power_[b] += energy / order_ / hops;
+
+      if (output_[b]) Synthesize(b, &beams_[b * samples_ + h * hop]);
+    }
+  }
+  return true;
+}
+
+};  // namespace matrix_hal
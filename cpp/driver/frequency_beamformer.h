@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_FREQUENCY_BEAMFORMER_H_
+#define CPP_DRIVER_FREQUENCY_BEAMFORMER_H_
+
+#include <stdint.h>
+#include <vector>
+#include "cpp/driver/fft_planner.h"
+
+namespace matrix_hal {
+
+/*
+Delay and sum of several beams at once, in frequency domain. Every channel
+is transformed once per hop with a sqrt-Hann window and 50% overlap; each
+beam is then a per-bin weighted sum of the channel spectra, turned back
+into audio by overlap-add. The FFTs do not depend on the number of beams,
+only the weighting and the inverse FFT of the beams that are output do.
+*/
+class FrequencyBeamformer {
+ public:
+  FrequencyBeamformer();
+  ~FrequencyBeamformer();
+
+  // |N| is the frame length, a power of two; a hop is N / 2 samples and
+  // the output lags the input by one hop.
+  bool Init(int N, int channels, int beams);
+  void Release();
+
+  // Delays channel c by |delays|[c] samples, possibly fractional, before
+  // the sum. Delays longer than a hop wrap around the frame.
+  void SetBeam(int beam, const float *delays);
+
+  // Steers |beam| towards a source position, see SteeringTable::Delays
+  void SetBeam(int beam, const float (*geometry)[2],
+               uint32_t sampling_frequency, float azimutal_angle,
+               float polar_angle, float radial_distance_mm = 100.0,
+               float sound_speed_mmseg = 320 * 1000.0);
+
+  // Only bins in [first_bin, last_bin] are summed; the rest are dropped
+  void SetBand(int first_bin, int last_bin);
+
+  // A beam that is not output only reports its Power(), skipping its
+  // inverse FFT. All beams are output by default.
+  void SetOutput(int beam, bool output);
+
+  // Processes |samples| per channel, a multiple of the hop, from |input|
+  // laid out as input[channel * samples + sample].
+  bool Exec(const int16_t *input, uint32_t samples);
+
+  // Audio of |beam| for the last Exec, |samples| long
+  int16_t *Beam(int beam) { return &beams_[beam * samples_]; }
+
+  // Mean energy per frame of |beam| over the last Exec, in the band
+  float Power(int beam) { return power_[beam]; }
+
+  // Beam with the highest Power() in the last Exec
+  int Loudest();
+
+  int Beams() { return beams_count_; }
+  int Channels() { return channels_; }
+  int Hop() { return order_ / 2; }
+  int Bins() { return order_ / 2 + 1; }
+
+ private:
+  void Analyze(const int16_t *input, uint32_t samples, uint32_t offset);
+  void Synthesize(int beam, int16_t *out);
+
+  int order_;
+  int channels_;
+  int beams_count_;
+  int first_bin_;
+  int last_bin_;
+  uint32_t samples_;
+
+  // Windowed frames and spectra of all channels, a frame (or Bins()) each.
+  // Synthesis reuses the first spectrum.
+  float *in_;
+  fftwf_complex *spectrum_;
+  float *out_;
+
+  // Every channel in one forward transform
+  FFTPlan forward_plan_;
+  FFTPlan inverse_plan_;
+
+  std::vector<float> window_;
+  // Last frame of every channel
+  std::vector<float> history_;
+  // Channel spectra of the current hop, real and imaginary parts apart
+  std::vector<float> real_;
+  std::vector<float> imag_;
+  // Weights of beam b and channel c at bins_ * (b * channels_ + c)
+  std::vector<float> weight_real_;
+  std::vector<float> weight_imag_;
+  std::vector<float> beam_real_;
+  std::vector<float> beam_imag_;
+  // Pending overlap-add tail of every beam, a hop each
+  std::vector<float> overlap_;
+  std::vector<char> output_;
+  std::vector<float> power_;
+  std::vector<int16_t> beams_;
+};
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_FREQUENCY_BEAMFORMER_H_
@@ -163,6 +163,26 @@ void GPIOControl::Setup(MatrixIOBus *bus) {
   }
 }
 
+bool GPIOControl::SetTimer(uint16_t pin, uint16_t prescaler, uint16_t period,
+                           uint16_t duty) {
+  uint16_t bank = pin / 4;
+  uint16_t channel = pin % 4;
+
+  uint32_t mask = 0xF << (4 * bank);
+  prescaler_ = prescaler << (4 * bank) | (prescaler_ & ~mask);
+
+  // Prescaler, period and duty go out as one bus transaction
+  BusSegment segments[3] = {
+      WriteSegment(kGPIOBaseAddress + 3,
+                   reinterpret_cast<unsigned char *>(&prescaler_),
+                   sizeof(prescaler_)),
+      WriteSegment(Bank(bank).mem_offset_ + 1,
+                   reinterpret_cast<unsigned char *>(&period), sizeof(period)),
+      WriteSegment(Bank(bank).mem_offset_ + 2 + channel,
+                   reinterpret_cast<unsigned char *>(&duty), sizeof(duty))};
+  return bus_->Transact(segments, 3);
+}
+
 bool GPIOControl::Set9GServoAngle(float angle, uint16_t pin) {
   if (!bus_) return false;
   if (pin > 15) return false;
@@ -202,14 +222,7 @@ bool GPIOControl::Set9GServoAngle(float angle, uint16_t pin) {
   // Using servo parameters to get duty
   uint16_t duty_counter = (ServoRatio * angle) + ServoOffset;
 
-  uint16_t bank = pin / 4;
-  uint16_t channel = pin % 4;
-
-  bool b1 = SetPrescaler(bank, GPIOPrescaler);
-  bool b2 = Bank(bank).SetPeriod(period_counter);
-  bool b3 = Bank(bank).SetDuty(channel, duty_counter);
-
-  return (b1 && b2 && b3);
+  return SetTimer(pin, GPIOPrescaler, period_counter, duty_counter);
 }
 
 bool GPIOControl::SetServoAngle(float angle, float min_pulse_ms, uint16_t pin) {
@@ -253,14 +266,7 @@ bool GPIOControl::SetServoAngle(float angle, float min_pulse_ms, uint16_t pin) {
   // Using servo parameters to get duty
   uint16_t duty_counter = (ServoRatio * angle) + ServoOffset;
 
-  uint16_t bank = pin / 4;
-  uint16_t channel = pin % 4;
-
-  bool b1 = SetPrescaler(bank, GPIOPrescaler);
-  bool b2 = Bank(bank).SetPeriod(period_counter);
-  bool b3 = Bank(bank).SetDuty(channel, duty_counter);
-
-  return (b1 && b2 && b3);
+  return SetTimer(pin, GPIOPrescaler, period_counter, duty_counter);
 }
 
 bool GPIOControl::SetPWM(float frequency, float percentage, uint16_t pin) {
@@ -293,14 +299,7 @@ bool GPIOControl::SetPWM(float frequency, float percentage, uint16_t pin) {
       (period_seconds * bus_->FPGAClock()) / ((1 << GPIOPrescaler) * 2);
   uint16_t duty_counter = (period_counter * percentage) / 100;
 
-  uint16_t bank = pin / 4;
-  uint16_t channel = pin % 4;
-
-  bool b1 = SetPrescaler(bank, GPIOPrescaler);
-  bool b2 = Bank(bank).SetPeriod(period_counter);
-  bool b3 = Bank(bank).SetDuty(channel, duty_counter);
-
-  return (b1 && b2 && b3);
+  return SetTimer(pin, GPIOPrescaler, period_counter, duty_counter);
 }
 
 };  // namespace matrix_hal
@@ -62,6 +62,10 @@ class GPIOControl : public MatrixDriver {
   uint16_t value_;
   uint16_t function_;
   uint16_t prescaler_;
+
+ private:
+  bool SetTimer(uint16_t pin, uint16_t prescaler, uint16_t period,
+                uint16_t duty);
 };
 
 };      // namespace matrix_hal
@@ -15,6 +15,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <memory>
 #include <string>
 
 #include "cpp/driver/creator_memory_map.h"
@@ -22,18 +23,39 @@
 
 namespace matrix_hal {
 
-bool IMUSensor::Read(IMUData *data) {
-  if (!bus_) return false;
+void IMUSensor::Convert(IMUData *data) {
   union {
     int *int_data;
     float *float_data;
   };
 
+  for (float_data = &data->accel_x; float_data <= &data->mag_z; float_data++)
+    *float_data = float(*int_data) / 1000.0;
+}
+
+bool IMUSensor::Read(IMUData *data) {
+  if (!bus_) return false;
+
   bus_->Read(kMCUBaseAddress + (kMemoryOffsetIMU >> 1), (unsigned char *)data,
              sizeof(IMUData));
 
-  for (float_data = &data->accel_x; float_data <= &data->mag_z; float_data++)
-    *float_data = float(*int_data) / 1000.0;
+  Convert(data);
   return true;
 }
+
+std::future<bool> IMUSensor::ReadAsync(IMUData *data) {
+  std::shared_ptr<std::promise<bool> > promise(new std::promise<bool>());
+  if (!bus_) {
+    promise->set_value(false);
+    return promise->get_future();
+  }
+
+  bus_->ReadAsync(kMCUBaseAddress + (kMemoryOffsetIMU >> 1),
+                  (unsigned char *)data, sizeof(IMUData),
+                  [data, promise](bool result) {
+                    if (result) Convert(data);
+                    promise->set_value(result);
+                  });
+  return promise->get_future();
+}
 };  // namespace matrix_hal
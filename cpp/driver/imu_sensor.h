@@ -18,6 +18,7 @@
 #ifndef CPP_DRIVER_IMU_SENSOR_H_
 #define CPP_DRIVER_IMU_SENSOR_H_
 
+#include <future>
 #include <string>
 #include "./imu_data.h"
 #include "./matrix_driver.h"
@@ -27,6 +28,12 @@ namespace matrix_hal {
 class IMUSensor : public MatrixDriver {
  public:
   bool Read(IMUData *data);
+  // Fills |data| from the bus I/O thread; |data| must stay valid until the
+  // returned future is ready.
+  std::future<bool> ReadAsync(IMUData *data);
+
+ private:
+  static void Convert(IMUData *data);
 };
 };      // namespace matrix_hal
 #endif  // CPP_DRIVER_IMU_SENSOR_H_
@@ -26,6 +26,8 @@ namespace matrix_hal {
 
 class MatrixDriver {
  public:
+  MatrixDriver() : bus_(NULL) {}
+
   void Setup(MatrixIOBus *bus);
 
   int MatrixLeds() { return bus_->MatrixLeds(); }
@@ -28,10 +28,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <string>
 #include "cpp/driver/bus_direct.h"
 #include "cpp/driver/bus_kernel.h"
+#include "cpp/driver/bus_simulated.h"
 #include "cpp/driver/creator_memory_map.h"
 
 namespace matrix_hal {
@@ -46,11 +49,53 @@ MatrixIOBus::MatrixIOBus()
       matrix_name_(0),
       matrix_leds_(0),
       bus_driver_(NULL),
-      direct_nkernel_(false) {}
+      io_queue_(NULL),
+      direct_nkernel_(false),
+      simulated_(false) {}
 
-bool MatrixIOBus::Init() {
+// Pending asynchronous requests are completed before returning
+MatrixIOBus::~MatrixIOBus() { delete io_queue_; }
+
+bool MatrixIOBus::Init(std::string simulation_source) {
   if (bus_driver_) delete bus_driver_;
+  bus_driver_ = NULL;
+  simulated_ = false;
+  register_cache_.Invalidate();
+
+  if (simulation_source.empty() && getenv("MATRIX_HAL_SIMULATION"))
+    simulation_source = getenv("MATRIX_HAL_SIMULATION");
+
+  if (!simulation_source.empty()) {
+    BusSimulated *bus_simulated = new BusSimulated();
+    const char *fast = getenv("MATRIX_HAL_SIMULATION_FAST");
+    bus_simulated->SetRealTime(!(fast && std::string(fast) == "1"));
+    if (!bus_simulated->Init(simulation_source)) {
+      delete bus_simulated;
+      return false;
+    }
+    bus_driver_ = bus_simulated;
+    direct_nkernel_ = false;
+    simulated_ = true;
+    std::cout << "INFO: [" << simulation_source << "] simulated bus"
+              << std::endl;
+  }
+
+  if (!simulated_ && !OpenHardwareBus()) return false;
+
+  Write(12, 13);
+  if (!GetMatrixName()) {
+    return false;
+  }
+
+  if (!GetFPGAFrequency()) {
+    std::cerr << "can't get FPGA frequency" << std::endl;
+    return false;
+  }
 
+  return true;
+}
+
+bool MatrixIOBus::OpenHardwareBus() {
   Bus *bus_direct = new BusDirect();
 
   Bus *bus_kernel = new BusKernel();
@@ -71,34 +116,213 @@ bool MatrixIOBus::Init() {
     std::cerr << "can't open any device" << std::endl;
     return false;
   }
+  return true;
+}
 
-  Write(12, 13);
-  if (!GetMatrixName()) {
-    return false;
-  }
-
-  if (!GetFPGAFrequency()) {
-    std::cerr << "can't get FPGA frequency" << std::endl;
-    return false;
-  }
-
+bool MatrixIOBus::AttachMicrophoneIRQ(void (*callback)(void)) {
+  if (!simulated_) return false;
+  static_cast<BusSimulated *>(bus_driver_)->SetIRQCallback(callback);
   return true;
 }
 
+// Sensor and control transfers are split so they never hold the bus for
+// longer than kBusArbitrationChunk bytes.
+static int ChunkLength(BusPriority priority, int length) {
+  if (priority < kBusPrioritySensors || length <= kBusArbitrationChunk)
+    return length;
+  return kBusArbitrationChunk;
+}
+
 bool MatrixIOBus::Write(uint16_t add, unsigned char *data, int length) {
-  return bus_driver_->Write(add, data, length);
+  BusPriority priority = BusPriorityOf(add);
+  int chunk = ChunkLength(priority, length);
+  bool result = true;
+
+  // The shadow is updated while the bus is still held, from the bytes that
+  // were sent: after the grant another writer of the same registers could
+  // land its update first, and a coalesced write sends someone else's data.
+  if (priority == kBusPriorityControl && chunk == length) {
+    Bus *bus_driver = bus_driver_;
+    RegisterCache *register_cache = &register_cache_;
+    uint64_t start = BusStatsClock();
+    uint64_t granted = 0;
+    uint64_t transfer_ns = 0;
+    result = arbiter_.CoalescedWrite(
+        priority, add, data, length,
+        [bus_driver, register_cache, &granted, &transfer_ns](
+            uint16_t add, const unsigned char *data, int length) {
+          granted = BusStatsClock();
+          bool result = bus_driver->Write(
+              add, const_cast<unsigned char *>(data), length);
+          transfer_ns = BusStatsClock() - granted;
+          if (result)
+            register_cache->UpdateWrite(add, data, length);
+          else
+            register_cache->Invalidate(add, length);
+          return result;
+        });
+    if (granted)
+      stats_.Record(add, length, granted - start, transfer_ns, result);
+  } else {
+    for (int offset = 0; offset < length && result; offset += chunk) {
+      int size = std::min(chunk, length - offset);
+      uint64_t start = BusStatsClock();
+      arbiter_.Acquire(priority);
+      uint64_t granted = BusStatsClock();
+      result = bus_driver_->Write(add + offset / 2, data + offset, size);
+      uint64_t end = BusStatsClock();
+      if (result)
+        register_cache_.UpdateWrite(add + offset / 2, data + offset, size);
+      else
+        register_cache_.Invalidate(add, length);
+      arbiter_.Release();
+      stats_.Record(add + offset / 2, size, granted - start, end - granted,
+                    result);
+    }
+  }
+  return result;
 }
 
 bool MatrixIOBus::Read(uint16_t add, unsigned char *data, int length) {
-  return bus_driver_->Read(add, data, length);
+  if (register_cache_.Lookup(add, data, length)) return true;
+
+  BusPriority priority = BusPriorityOf(add);
+  int chunk = ChunkLength(priority, length);
+  for (int offset = 0; offset < length; offset += chunk) {
+    int size = std::min(chunk, length - offset);
+    uint64_t start = BusStatsClock();
+    arbiter_.Acquire(priority);
+    uint64_t granted = BusStatsClock();
+    bool result = bus_driver_->Read(add + offset / 2, data + offset, size);
+    uint64_t end = BusStatsClock();
+    // Before a later write can reach the bus, see Write
+    if (result)
+      register_cache_.UpdateRead(add + offset / 2, data + offset, size);
+    arbiter_.Release();
+    stats_.Record(add + offset / 2, size, granted - start, end - granted,
+                  result);
+    if (!result) return false;
+  }
+  return true;
 }
 
 bool MatrixIOBus::Write(uint16_t add, uint16_t data) {
-  return bus_driver_->Write(add, (unsigned char *)(&data), sizeof(data));
+  return Write(add, (unsigned char *)(&data), sizeof(data));
 }
 
 bool MatrixIOBus::Read(uint16_t add, uint16_t *data) {
-  return bus_driver_->Read(add, (unsigned char *)data, sizeof(*data));
+  return Read(add, (unsigned char *)data, sizeof(*data));
+}
+
+bool MatrixIOBus::ReadInPlace(uint16_t add, unsigned char *buffer,
+                              int length) {
+  uint64_t start = BusStatsClock();
+  arbiter_.Acquire(BusPriorityOf(add));
+  uint64_t granted = BusStatsClock();
+  bool result = bus_driver_->ReadInPlace(add, buffer, length);
+  uint64_t end = BusStatsClock();
+  if (result) register_cache_.UpdateRead(add, buffer + ReadHeadroom(), length);
+  arbiter_.Release();
+  stats_.Record(add, length, granted - start, end - granted, result);
+  return result;
+}
+
+bool MatrixIOBus::Transact(BusSegment *segments, int count) {
+  if (count <= 0 || count > kMaxBusSegments) return false;
+
+  // The shadow only changes while the bus is held, so it follows the order
+  // of the transfers. Reads it can answer are dropped from the batch; when
+  // the batch writes, that is decided under the grant too, with the writes
+  // before each read already in the shadow.
+  bool writes = false;
+  BusPriority priority = kBusPriorityControl;
+  for (int i = 0; i < count; i++) {
+    writes = writes || !segments[i].read;
+    priority = std::min(priority, BusPriorityOf(segments[i].address));
+  }
+
+  uint64_t start = BusStatsClock();
+  if (writes) arbiter_.Acquire(priority);
+
+  BusSegment pending[kMaxBusSegments];
+  int pending_count = 0;
+  BusPriority pending_priority = kBusPriorityControl;
+  for (int i = 0; i < count; i++) {
+    BusSegment &segment = segments[i];
+    if (segment.read) {
+      if (register_cache_.Lookup(segment.address, segment.data,
+                                 segment.length))
+        continue;
+    } else {
+      register_cache_.UpdateWrite(segment.address, segment.data,
+                                  segment.length);
+    }
+    pending[pending_count++] = segment;
+    pending_priority =
+        std::min(pending_priority, BusPriorityOf(segment.address));
+  }
+  if (pending_count == 0) return true;
+
+  if (!writes) {
+    start = BusStatsClock();
+    arbiter_.Acquire(pending_priority);
+  }
+  uint64_t granted = BusStatsClock();
+  bool result = bus_driver_->Transact(pending, pending_count);
+  uint64_t end = BusStatsClock();
+  for (int i = 0; i < pending_count; i++) {
+    if (!result)
+      register_cache_.Invalidate(pending[i].address, pending[i].length);
+    else if (pending[i].read)
+      register_cache_.UpdateRead(pending[i].address, pending[i].data,
+                                 pending[i].length);
+  }
+  arbiter_.Release();
+
+  // Each segment is charged its share of the transaction by length
+  int total = 0;
+  for (int i = 0; i < pending_count; i++) total += pending[i].length;
+  for (int i = 0; i < pending_count; i++) {
+    double share = total ? double(pending[i].length) / total : 0;
+    stats_.Record(pending[i].address, pending[i].length,
+                  uint64_t((granted - start) * share),
+                  uint64_t((end - granted) * share), result);
+  }
+  return result;
+}
+
+BusIOQueue *MatrixIOBus::IOQueue() {
+  std::call_once(io_queue_once_, [this] { io_queue_ = new BusIOQueue(this); });
+  return io_queue_;
+}
+
+std::future<bool> MatrixIOBus::ReadAsync(uint16_t add, unsigned char *data,
+                                         int length) {
+  std::shared_ptr<std::promise<bool> > promise(new std::promise<bool>());
+  ReadAsync(add, data, length,
+            [promise](bool result) { promise->set_value(result); });
+  return promise->get_future();
+}
+
+std::future<bool> MatrixIOBus::WriteAsync(uint16_t add,
+                                          const unsigned char *data,
+                                          int length) {
+  std::shared_ptr<std::promise<bool> > promise(new std::promise<bool>());
+  WriteAsync(add, data, length,
+             [promise](bool result) { promise->set_value(result); });
+  return promise->get_future();
+}
+
+void MatrixIOBus::ReadAsync(uint16_t add, unsigned char *data, int length,
+                            const std::function<void(bool)> &done) {
+  IOQueue()->Submit(ReadSegment(add, data, length), done);
+}
+
+void MatrixIOBus::WriteAsync(uint16_t add, const unsigned char *data,
+                             int length,
+                             const std::function<void(bool)> &done) {
+  IOQueue()->Submit(
+      WriteSegment(add, const_cast<unsigned char *>(data), length), done);
 }
 
 bool MatrixIOBus::GetMatrixName() {
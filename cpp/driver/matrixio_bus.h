@@ -19,9 +19,15 @@
 #define CPP_DRIVER_WISHBONE_BUS_H_
 
 #include <stdint.h>
+#include <functional>
+#include <future>
 #include <mutex>
 #include <string>
 #include "./bus.h"
+#include "./bus_arbiter.h"
+#include "./bus_io_queue.h"
+#include "./bus_stats.h"
+#include "./register_cache.h"
 
 namespace matrix_hal {
 
@@ -34,8 +40,13 @@ const int kMatrixVoice = 0x6032BAD2;
 class MatrixIOBus {
  public:
   MatrixIOBus();
+  ~MatrixIOBus();
 
-  bool Init();
+  // An empty |simulation_source| opens the SPI or kernel bus. Otherwise, or
+  // when MATRIX_HAL_SIMULATION is set, a BusSimulated replays that recording
+  // (see BusSimulated::Init); set MATRIX_HAL_SIMULATION_FAST=1 to replay it
+  // as fast as it is consumed instead of at the real block rate.
+  bool Init(std::string simulation_source = "");
 
   bool Write(uint16_t add, unsigned char *data, int length);
 
@@ -45,6 +56,29 @@ class MatrixIOBus {
 
   bool Read(uint16_t add, uint16_t *data);
 
+  // Runs several reads and writes back to back as one bus transaction.
+  bool Transact(BusSegment *segments, int count);
+
+  // Zero-copy read, see Bus::ReadInPlace
+  int ReadHeadroom() { return bus_driver_->ReadHeadroom(); }
+
+  bool ReadInPlace(uint16_t add, unsigned char *buffer, int length);
+
+  // Asynchronous transfers, run in submission order by a single I/O thread
+  // that packs adjacent requests into one transaction. |data| of a write is
+  // copied at submission; the buffer of a read must outlive the completion.
+  // Callbacks run on the I/O thread and must not block on the bus.
+  std::future<bool> ReadAsync(uint16_t add, unsigned char *data, int length);
+
+  std::future<bool> WriteAsync(uint16_t add, const unsigned char *data,
+                               int length);
+
+  void ReadAsync(uint16_t add, unsigned char *data, int length,
+                 const std::function<void(bool)> &done);
+
+  void WriteAsync(uint16_t add, const unsigned char *data, int length,
+                  const std::function<void(bool)> &done);
+
   uint32_t FPGAClock() { return fpga_frequency_; }
 
   uint32_t MatrixName() { return matrix_name_; }
@@ -55,9 +89,48 @@ class MatrixIOBus {
 
   bool IsDirectBus() { return direct_nkernel_; }
 
+  bool IsSimulatedBus() { return simulated_; }
+
+  // Shadow copy of the configuration and GPIO registers. Cacheable registers
+  // are read from the bus once and then served locally; anything the FPGA
+  // may change behind our back must be declared volatile or invalidated.
+  void SetRegisterPolicy(uint16_t add, uint16_t words, RegisterPolicy policy) {
+    register_cache_.SetPolicy(add, words, policy);
+  }
+
+  void InvalidateRegisterCache() { register_cache_.Invalidate(); }
+
+  void InvalidateRegisterCache(uint16_t add, int length) {
+    register_cache_.Invalidate(add, length);
+  }
+
+  // Wait time per priority class, see BusArbiter
+  BusArbiterStats ArbitrationStats() { return arbiter_.Stats(); }
+
+  void ResetArbitrationStats() { arbiter_.ResetStats(); }
+
+  void ShowArbitrationStats() { arbiter_.ShowStatistics(); }
+
+  // Calls, bytes, lock wait and transfer time per address region, see
+  // BusStats. Register cache hits and coalesced writes never reach the bus
+  // and are not counted.
+  BusStatsSnapshot Stats() { return stats_.Snapshot(); }
+
+  void ResetStats() { stats_.Reset(); }
+
+  void ShowStats() { stats_.ShowStatistics(); }
+
+  std::string StatsJSON() { return stats_.JSON(); }
+
+  // Routes the microphone IRQ to |callback|. Returns false on hardware, where
+  // the IRQ is a GPIO line that has to be hooked with wiringPiISR.
+  bool AttachMicrophoneIRQ(void (*callback)(void));
+
  private:
+  bool OpenHardwareBus();
   bool GetMatrixName();
   bool GetFPGAFrequency();
+  BusIOQueue *IOQueue();
 
  private:
   uint32_t fpga_frequency_;  // Internal FPGA clock - DCM
@@ -65,7 +138,13 @@ class MatrixIOBus {
   uint32_t matrix_version_;
   int matrix_leds_;
   Bus *bus_driver_;
+  RegisterCache register_cache_;
+  BusArbiter arbiter_;
+  BusStats stats_;
+  BusIOQueue *io_queue_;  // started by the first asynchronous request
+  std::once_flag io_queue_once_;
   bool direct_nkernel_;
+  bool simulated_;
 };
 };      // namespace matrix_hal
 #endif  // CPP_DRIVER_WISHBONE_BUS_H_
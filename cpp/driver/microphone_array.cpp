@@ -15,42 +15,116 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <time.h>
 #include <wiringPi.h>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <map>
+#include <mutex>
 #include <string>
 #include <valarray>
 
 #include "cpp/driver/creator_memory_map.h"
+#include "cpp/driver/delay_and_sum.h"
 #include "cpp/driver/microphone_array.h"
 #include "cpp/driver/microphone_array_location.h"
+#include "cpp/driver/sample_layout.h"
 
 static std::mutex irq_m;
 static std::condition_variable irq_cv;
-
-void irq_callback(void) { irq_cv.notify_all(); }
+static std::atomic<uint64_t> irq_sequence(0);
+static std::atomic<uint64_t>
+    irq_timestamps[matrix_hal::kMicrophoneIRQTimestamps];
+
+// Every IRQ edge marks a new block in the FPGA buffer
+void irq_callback(void) {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t sequence = irq_sequence.load(std::memory_order_relaxed) + 1;
+  irq_timestamps[sequence % matrix_hal::kMicrophoneIRQTimestamps].store(
+      uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec,
+      std::memory_order_relaxed);
+  irq_sequence.store(sequence, std::memory_order_release);
+
+  // Taking the mutex orders the store against a reader that has checked
+  // the sequence but not started waiting yet, so no wakeup is lost
+  { std::lock_guard<std::mutex> lock(irq_m); }
+  irq_cv.notify_all();
+}
 
 namespace matrix_hal {
 
 MicrophoneArray::MicrophoneArray(bool enable_beamforming)
-    : lock_(irq_m), gain_(3), sampling_frequency_(16000), enable_beamforming_(enable_beamforming) {
-  raw_data_.resize(kMicarrayBufferSize);
+    : gain_(3), sampling_frequency_(16000), enable_beamforming_(enable_beamforming) {
+  raw_buffer_.resize(kMicarrayBufferSize);
+  block_data_ = raw_data_ = &raw_buffer_[0];
+  raw_stride_ = block_samples_ = kMicarrayBlockSamples;
+  sub_block_offset_ = kMicarrayBlockSamples;
+
+  block_info_.sequence = 0;
+  block_info_.timestamp_ns = 0;
+  block_info_.missed_blocks = 0;
+  ResetOverrunStats();
+
+  for (int c = 0; c < kMicrophoneChannels; c++) {
+    delayed_[c] = NULL;
+    steering_vector_.offset[c] = 0;
+    for (int k = 0; k < kFractionalDelayTaps; k++)
+      steering_vector_.taps[c][k] = k == 1 ? 1 : 0;
+  }
+  previous_vector_ = steering_vector_;
+  crossfade_ = false;
+  steering_pending_ = false;
+  steering_grid_[0] = steering_grid_[1] = 0;
+  steering_direction_ = -1;
 
   if (enable_beamforming_)
   {
-    delayed_data_.resize(kMicarrayBufferSize);
+    ResizeBeamformingBuffers();
 
-    fifos_.resize(kMicrophoneChannels);
+    CalculateDelays(0.0, 0.0);
+  }
+}
 
-    beamformed_.resize(NumberOfSamples());
+void MicrophoneArray::ResizeBeamformingBuffers() {
+  lines_.resize(kMicrophoneChannels *
+                (kBeamformingHistory + NumberOfSamples()));
+  steered_.resize(kMicrophoneChannels * NumberOfSamples());
 
-    CalculateDelays(0.0, 0.0);
+  beamformed_.resize(NumberOfSamples());
+}
+
+bool MicrophoneArray::SetBlockSize(uint32_t samples) {
+  bool divisor = samples >= 8 && kMicarrayBlockSamples % samples == 0;
+  bool multiple =
+      samples % kMicarrayBlockSamples == 0 &&
+      samples <= kMicarrayBlockSamples * kMicarrayMaxAggregatedBlocks;
+  if (!samples || (!divisor && !multiple)) {
+    std::cerr << "Unsupported block size " << samples << ", use a divisor or "
+              << "a multiple of " << kMicarrayBlockSamples << std::endl;
+    return false;
+  }
+
+  block_samples_ = samples;
+  if (samples > kMicarrayBlockSamples) {
+    frame_.resize(kMicrophoneChannels * samples);
+    raw_data_ = &frame_[0];
+    raw_stride_ = samples;
+  } else {
+    frame_.resize(0);
+    raw_data_ = block_data_;
+    raw_stride_ = kMicarrayBlockSamples;
   }
+  // Start the next read on a fresh FPGA block
+  sub_block_offset_ = kMicarrayBlockSamples;
+
+  if (enable_beamforming_) ResizeBeamformingBuffers();
+  return true;
 }
 
 MicrophoneArray::~MicrophoneArray() {}
@@ -58,47 +132,216 @@ MicrophoneArray::~MicrophoneArray() {}
 void MicrophoneArray::Setup(MatrixIOBus *bus) {
   MatrixDriver::Setup(bus);
 
-  wiringPiSetup();
+  if (!bus->AttachMicrophoneIRQ(&irq_callback)) {
+    wiringPiSetup();
 
-  pinMode(kMicrophoneArrayIRQ, INPUT);
-  wiringPiISR(kMicrophoneArrayIRQ, INT_EDGE_BOTH, &irq_callback);
+    pinMode(kMicrophoneArrayIRQ, INPUT);
+    wiringPiISR(kMicrophoneArrayIRQ, INT_EDGE_BOTH, &irq_callback);
+  }
+
+  // Leave room for the bus header so Read() lands the block in place
+  int headroom = bus->ReadHeadroom() / sizeof(int16_t);
+  raw_buffer_.resize(headroom + kMicarrayBufferSize);
+  block_data_ = &raw_buffer_[headroom];
+  if (block_samples_ <= kMicarrayBlockSamples) raw_data_ = block_data_;
 
   ReadConfValues();
+
+  // The geometry depends on the board, now known
+  ReapplySteering();
+}
+
+void MicrophoneArray::ResetOverrunStats() {
+  overrun_stats_.blocks_read = 0;
+  overrun_stats_.blocks_missed = 0;
+  overrun_stats_.overruns = 0;
+  overrun_stats_.max_missed_blocks = 0;
+}
+
+bool MicrophoneArray::Read(MicrophoneBlockInfo *info) {
+  if (!Read()) return false;
+  if (info) *info = block_info_;
+  return true;
+}
+
+void MicrophoneArray::WaitForBlock() {
+  uint64_t last = block_info_.sequence;
+  uint64_t sequence;
+  {
+    std::unique_lock<std::mutex> lock(irq_m);
+    irq_cv.wait(lock, [&sequence, last] {
+      sequence = irq_sequence.load(std::memory_order_acquire);
+      return sequence != last;
+    });
+  }
+
+  // The first block read has nothing to be compared with
+  uint64_t missed = last ? sequence - last - 1 : 0;
+  block_info_.sequence = sequence;
+  block_info_.timestamp_ns =
+      irq_timestamps[sequence % kMicrophoneIRQTimestamps].load(
+          std::memory_order_relaxed);
+  block_info_.missed_blocks = missed;
+
+  overrun_stats_.blocks_read++;
+  if (missed) {
+    overrun_stats_.blocks_missed += missed;
+    overrun_stats_.overruns++;
+    overrun_stats_.max_missed_blocks =
+        std::max(overrun_stats_.max_missed_blocks, missed);
+  }
+}
+
+bool MicrophoneArray::ReadBlock() {
+  return bus_->ReadInPlace(kMicrophoneArrayBaseAddress,
+                           reinterpret_cast<unsigned char *>(&raw_buffer_[0]),
+                           sizeof(int16_t) * kMicarrayBufferSize);
+}
+
+void MicrophoneArray::DelayChannels() {
+  const uint32_t samples = NumberOfSamples();
+
+  {
+    std::unique_lock<std::mutex> lock(steering_m_);
+    if (steering_pending_) {
+      previous_vector_ = steering_vector_;
+      steering_vector_ = pending_vector_;
+      steering_pending_ = false;
+      crossfade_ = true;
+    }
+  }
+
+  for (int c = 0; c < kMicrophoneChannels; c++) {
+    int16_t *line = Line(c);
+    // The tail of the previous block becomes the history of this one
+    std::copy(line + samples, line + samples + kBeamformingHistory, line);
+    const int16_t *raw = RawChannel(c);
+    std::copy(raw, raw + samples, line + kBeamformingHistory);
+
+    const int16_t *x = line + kBeamformingHistory;
+    int offset = steering_vector_.offset[c];
+    const float *taps = steering_vector_.taps[c];
+    int16_t *steered = &steered_[c * samples];
+
+    if (crossfade_) {
+      FractionalDelayCrossfade(x, previous_vector_.offset[c],
+                               previous_vector_.taps[c], offset, taps, samples,
+                               steered);
+      delayed_[c] = steered;
+    } else if (IsIntegerDelay(taps)) {
+      delayed_[c] = line + kBeamformingHistory - offset - 1;
+    } else {
+      FractionalDelay(x, offset, taps, samples, steered);
+      delayed_[c] = steered;
+    }
+  }
+  crossfade_ = false;
+}
+
+// Points raw_data_ at the next block of NumberOfSamples(), reading as many
+// FPGA blocks as it takes
+bool MicrophoneArray::NextBlock() {
+  if (block_samples_ == kMicarrayBlockSamples) {
+    WaitForBlock();
+    return ReadBlock();
+  }
+
+  if (block_samples_ < kMicarrayBlockSamples) {
+    if (sub_block_offset_ >= kMicarrayBlockSamples) {
+      WaitForBlock();
+      if (!ReadBlock()) return false;
+      sub_block_offset_ = 0;
+    } else {
+      // Already counted with the first sub-block
+      block_info_.missed_blocks = 0;
+    }
+    raw_data_ = block_data_ + sub_block_offset_;
+    sub_block_offset_ += block_samples_;
+    return true;
+  }
+
+  uint64_t missed = 0;
+  for (uint32_t offset = 0; offset < block_samples_;
+       offset += kMicarrayBlockSamples) {
+    WaitForBlock();
+    missed += block_info_.missed_blocks;
+    if (!ReadBlock()) return false;
+    for (int c = 0; c < kMicrophoneChannels; c++) {
+      const int16_t *block = block_data_ + c * kMicarrayBlockSamples;
+      std::copy(block, block + kMicarrayBlockSamples,
+                &frame_[c * block_samples_ + offset]);
+    }
+  }
+  block_info_.missed_blocks = missed;
+  return true;
 }
 
 //  Read audio from the FPGA and calculate beam using delay & sum method
 bool MicrophoneArray::Read() {
-  // TODO(andres.calderon@admobilize.com): avoid double buffer
   if (!bus_) return false;
 
-  irq_cv.wait(lock_);
+  if (!NextBlock()) return false;
 
-  if (!bus_->Read(kMicrophoneArrayBaseAddress,
-                  reinterpret_cast<unsigned char *>(&raw_data_[0]),
-                  sizeof(int16_t) * kMicarrayBufferSize)) {
-    return false;
+  if (enable_beamforming_) {
+    DelayChannels();
+    matrix_hal::DelayAndSum(delayed_, kMicrophoneChannels, NumberOfSamples(),
+                            &beamformed_[0]);
+  }
+  return true;
+}
+
+bool MicrophoneArray::ReadInto(int16_t *buffer, SampleLayout layout,
+                               int16_t *beam, MicrophoneBlockInfo *info) {
+  if (!bus_ || !buffer) return false;
+
+  const uint32_t samples = NumberOfSamples();
+
+  if (!enable_beamforming_ && layout == kPlanar &&
+      samples == kMicarrayBlockSamples && bus_->ReadHeadroom() == 0) {
+    WaitForBlock();
+    if (info) *info = block_info_;
+    // The FPGA block is already planar, nothing to copy
+    return bus_->ReadInPlace(kMicrophoneArrayBaseAddress,
+                             reinterpret_cast<unsigned char *>(buffer),
+                             sizeof(int16_t) * kMicarrayBufferSize);
   }
 
-  if (enable_beamforming_)
-  {
-    for (uint32_t s = 0; s < NumberOfSamples(); s++) {
-      int sum = 0;
-      for (int c = 0; c < kMicrophoneChannels; c++) {
-        // delaying data for beamforming 'delay & sum' algorithm
-        delayed_data_[s * kMicrophoneChannels + c] =
-            fifos_[c].PushPop(raw_data_[c * NumberOfSamples() + s]);
-
-        // accumulation data for beamforming 'delay & sum' algorithm
-        sum += delayed_data_[s * kMicrophoneChannels + c];
-      }
-
-      beamformed_[s] = std::min(INT16_MAX, std::max(sum, INT16_MIN));
-    }
+  bool result = NextBlock();
+  if (info) *info = block_info_;
+  if (!result) return false;
+
+  const int16_t *channels[kMicrophoneChannels];
+  for (int c = 0; c < kMicrophoneChannels; c++) channels[c] = RawChannel(c);
+
+  if (enable_beamforming_) {
+    DelayChannels();
+    for (int c = 0; c < kMicrophoneChannels; c++) channels[c] = delayed_[c];
+    if (beam)
+      matrix_hal::DelayAndSum(channels, kMicrophoneChannels, samples, beam);
+  }
+
+  if (layout == kPlanar) {
+    for (int c = 0; c < kMicrophoneChannels; c++)
+      std::copy(channels[c], channels[c] + samples, buffer + c * samples);
+  } else {
+    Interleave(channels, kMicrophoneChannels, samples, buffer);
   }
   return true;
 }
 
-// Setting fifos for the 'delay & sum' algorithm
+const float (*MicrophoneArray::Geometry())[2] {
+  // Use Proper Micarray Location (Creator or Voice)
+  if (bus_ && MatrixLeds() == kMatrixVoiceNLeds)
+    return micarray_location_voice;
+  return micarray_location_creator;
+}
+
+void MicrophoneArray::SetSteeringVector(const SteeringVector &vector) {
+  std::unique_lock<std::mutex> lock(steering_m_);
+  pending_vector_ = vector;
+  steering_pending_ = true;
+}
+
 void MicrophoneArray::CalculateDelays(float azimutal_angle, float polar_angle,
                                       float radial_distance_mm,
                                       float sound_speed_mmseg) {
@@ -107,38 +350,54 @@ void MicrophoneArray::CalculateDelays(float azimutal_angle, float polar_angle,
               << std::endl;
     return;
   }
-  //  sound source position
-  float x, y, z;
-  x = radial_distance_mm * std::sin(azimutal_angle) * std::cos(polar_angle);
-  y = radial_distance_mm * std::sin(azimutal_angle) * std::sin(polar_angle);
-  z = radial_distance_mm * std::cos(azimutal_angle);
+  steering_direction_ = -1;
+  steering_[0] = azimutal_angle;
+  steering_[1] = polar_angle;
+  steering_[2] = radial_distance_mm;
+  steering_[3] = sound_speed_mmseg;
+
+  SteeringVector vector;
+  SteeringTable::Compute(Geometry(), sampling_frequency_, azimutal_angle,
+                         polar_angle, radial_distance_mm, sound_speed_mmseg,
+                         kBeamformingHistory, &vector);
+  SetSteeringVector(vector);
+}
 
-  std::map<float, int> distance_map;
+void MicrophoneArray::SetSteeringGrid(int azimutal_steps, int polar_steps,
+                                      float radial_distance_mm,
+                                      float sound_speed_mmseg) {
+  if (sound_speed_mmseg == 0) {
+    std::cerr << "Bad Configuration, Sound Speed must be greather than 0"
+              << std::endl;
+    return;
+  }
+  steering_grid_[0] = azimutal_steps;
+  steering_grid_[1] = polar_steps;
+  steering_grid_source_[0] = radial_distance_mm;
+  steering_grid_source_[1] = sound_speed_mmseg;
+  steering_table_.Build(Geometry(), sampling_frequency_, azimutal_steps,
+                        polar_steps, radial_distance_mm, sound_speed_mmseg,
+                        kBeamformingHistory);
+}
 
-  // sorted distances from source position to each microphone
-  for (int c = 0; c < kMicrophoneChannels; c++) {
-    // Use Proper Micarray Location (Creator or Voice)
-    float distance = 0;
-    if (MatrixLeds() == 18)
-      distance = std::sqrt(std::pow(micarray_location_voice[c][0] - x, 2.0) +
-                           std::pow(micarray_location_voice[c][1] - y, 2.0) +
-                           std::pow(z, 2.0));
-    else
-      distance = std::sqrt(std::pow(micarray_location_creator[c][0] - x, 2.0) +
-                           std::pow(micarray_location_creator[c][1] - y, 2.0) +
-                           std::pow(z, 2.0));
+bool MicrophoneArray::Steer(int direction) {
+  if (direction < 0 || direction >= steering_table_.Directions())
+    return false;
+  steering_direction_ = direction;
+  SetSteeringVector(steering_table_.Vector(direction));
+  return true;
+}
 
-    distance_map[distance] = c;
-  }
+void MicrophoneArray::ReapplySteering() {
+  if (!enable_beamforming_) return;
 
-  // fifo resize for delay compensation
-  float min_distance = distance_map.begin()->first;
-  for (std::map<float, int>::iterator it = distance_map.begin();
-       it != distance_map.end(); ++it) {
-    int delay = std::round((it->first - min_distance) * sampling_frequency_ /
-                           sound_speed_mmseg);
-    fifos_[it->second].Resize(delay);
-  }
+  if (steering_grid_[0] > 0)
+    SetSteeringGrid(steering_grid_[0], steering_grid_[1],
+                    steering_grid_source_[0], steering_grid_source_[1]);
+  if (steering_direction_ >= 0)
+    Steer(steering_direction_);
+  else
+    CalculateDelays(steering_[0], steering_[1], steering_[2], steering_[3]);
 }
 
 bool MicrophoneArray::GetGain() {
@@ -178,8 +437,19 @@ bool MicrophoneArray::SetSamplingRate(uint32_t sampling_frequency) {
       break;
     }
   }
-  SetGain(MIC_gain);
-  bus_->Write(kConfBaseAddress + 0x06, MIC_constant);
+  if (!bus_) return false;
+  BusSegment segments[2] = {
+      WriteSegment(kConfBaseAddress + 0x07,
+                   reinterpret_cast<unsigned char *>(&MIC_gain),
+                   sizeof(MIC_gain)),
+      WriteSegment(kConfBaseAddress + 0x06,
+                   reinterpret_cast<unsigned char *>(&MIC_constant),
+                   sizeof(MIC_constant))};
+  if (!bus_->Transact(segments, 2)) return false;
+  gain_ = MIC_gain;
+
+  // Delays are counted in samples
+  ReapplySteering();
 
   return true;
 }
@@ -209,5 +479,8 @@ void MicrophoneArray::ShowConfiguration() {
   std::cout << "Audio Configuration: " << std::endl;
   std::cout << "Sampling Frequency: " << sampling_frequency_ << std::endl;
   std::cout << "Gain : " << gain_ << std::endl;
+  std::cout << "Block size : " << block_samples_ << std::endl;
+  if (enable_beamforming_)
+    std::cout << "Beamforming kernel : " << DelayAndSumKernel() << std::endl;
 }
 };  // namespace matrix_hal
@@ -18,13 +18,15 @@
 #ifndef CPP_DRIVER_MICROPHONE_ARRAY_H_
 #define CPP_DRIVER_MICROPHONE_ARRAY_H_
 
+#include <stdint.h>
 #include <mutex>
 #include <string>
 #include <valarray>
 
-#include "./circular_queue.h"
+#include "./beam_steering.h"
 #include "./matrix_driver.h"
 #include "./pressure_data.h"
+#include "./sample_layout.h"
 
 namespace matrix_hal {
 
@@ -36,6 +38,33 @@ static const uint32_t MIC_sampling_frequencies[][3] = {
 const uint16_t kMicarrayBufferSize = 4096;
 const uint16_t kMicrophoneArrayIRQ = 22;  // GPIO06 - WiringPi:22
 const uint16_t kMicrophoneChannels = 8;
+// Samples per channel in each FPGA block
+const uint32_t kMicarrayBlockSamples =
+    kMicarrayBufferSize / kMicrophoneChannels;
+// Largest software block, in FPGA blocks
+const uint32_t kMicarrayMaxAggregatedBlocks = 32;
+// Longest beamforming delay, in samples. The widest Creator baseline is
+// about 105 mm, 32 samples at 96 kHz.
+const int kBeamformingHistory = 64;
+// IRQ capture times kept for blocks not yet read
+const int kMicrophoneIRQTimestamps = 64;
+
+struct MicrophoneBlockInfo {
+  // Number of microphone IRQs up to and including this block
+  uint64_t sequence;
+  // CLOCK_MONOTONIC time of the block IRQ, in nanoseconds
+  uint64_t timestamp_ns;
+  // Blocks the FPGA completed since the previous Read that were never read
+  uint64_t missed_blocks;
+};
+
+struct MicrophoneOverrunStats {
+  uint64_t blocks_read;
+  uint64_t blocks_missed;
+  // Reads that found at least one block missed
+  uint64_t overruns;
+  uint64_t max_missed_blocks;
+};
 
 class MicrophoneArray : public MatrixDriver {
  public:
@@ -44,7 +73,21 @@ class MicrophoneArray : public MatrixDriver {
   ~MicrophoneArray();
 
   void Setup(MatrixIOBus *bus);
+  // Waits for a block newer than the last one read. If the caller fell
+  // behind, returns the latest block at once and counts the skipped ones.
   bool Read();
+  bool Read(MicrophoneBlockInfo *info);
+  // Reads one block into the caller's |buffer| of Channels() *
+  // NumberOfSamples() samples in |layout|. With beamforming enabled the
+  // channels are delayed as in At(), and the delay and sum goes to |beam|
+  // when given. A planar read with beamforming off lands straight in
+  // |buffer| on buses without read headroom. Raw(), At() and Beam() are
+  // unspecified afterwards.
+  bool ReadInto(int16_t *buffer, SampleLayout layout, int16_t *beam = NULL,
+                MicrophoneBlockInfo *info = NULL);
+  const MicrophoneBlockInfo &BlockInfo() { return block_info_; }
+  MicrophoneOverrunStats OverrunStats() { return overrun_stats_; }
+  void ResetOverrunStats();
   uint32_t SamplingRate() { return sampling_frequency_; }
   uint16_t Gain() { return gain_; }
   bool SetSamplingRate(uint32_t sampling_frequency);
@@ -54,40 +97,118 @@ class MicrophoneArray : public MatrixDriver {
   void ReadConfValues();
   void ShowConfiguration();
   uint16_t Channels() { return kMicrophoneChannels; }
-  uint32_t NumberOfSamples() {
-    return kMicarrayBufferSize / kMicrophoneChannels;
-  }
+  // Samples per channel delivered by each Read, see SetBlockSize
+  uint32_t NumberOfSamples() { return block_samples_; }
+
+  // Sets the samples per channel of each Read. A divisor of the FPGA block
+  // (kMicarrayBlockSamples), down to 8, splits every FPGA block into
+  // several reads for consumers that work on smaller blocks. The sub-blocks
+  // are only delivered once their whole FPGA block has arrived, so this
+  // does not reduce capture latency. A multiple of it, up to
+  // kMicarrayMaxAggregatedBlocks blocks, gathers consecutive FPGA blocks
+  // into one read. Sub-blocks share the sequence and timestamp of their
+  // FPGA block; an aggregated block reports its last FPGA block and the
+  // blocks missed in all of them. Call between reads.
+  bool SetBlockSize(uint32_t samples);
 
   int16_t &Raw(int16_t sample, int16_t channel) {
-    return raw_data_[channel * NumberOfSamples() + sample];
+    return raw_data_[channel * raw_stride_ + sample];
   }
 
   int16_t &At(int16_t sample, int16_t channel) {
     if (!enable_beamforming_)
       return Raw(sample, channel);
-    return delayed_data_[sample * kMicrophoneChannels + channel];
+    return delayed_[channel][sample];
+  }
+
+  // Contiguous NumberOfSamples() samples of |channel| from the last Read,
+  // as Raw() and At() would return them one by one
+  const int16_t *RawChannel(uint16_t channel) {
+    return raw_data_ + channel * raw_stride_;
+  }
+
+  const int16_t *Channel(uint16_t channel) {
+    if (!enable_beamforming_) return RawChannel(channel);
+    return delayed_[channel];
   }
 
   //call at own peril if beamforming is disabled
   int16_t &Beam(int16_t sample) { return beamformed_[sample]; }
 
+  // Steers the beam towards a source position, with fractional delays.
+  // Takes effect on the next block, crossfading over it; does not allocate.
   void CalculateDelays(float azimutal_angle, float polar_angle,
                        float radial_distance_mm = 100.0,
                        float sound_speed_mmseg = 320 * 1000.0);
 
+  // Precomputes the steering vectors of a grid of directions for this board
+  // and sampling rate, see SteeringTable.
+  void SetSteeringGrid(int azimutal_steps, int polar_steps,
+                       float radial_distance_mm = 100.0,
+                       float sound_speed_mmseg = 320 * 1000.0);
+  const SteeringTable &Steering() { return steering_table_; }
+
+  // Steers to a grid direction the way CalculateDelays does, but without
+  // any trigonometry. Safe to call from another thread between reads.
+  bool Steer(int direction);
+
+  // (x, y) position of each microphone in mm, Creator or Voice
+  const float (*Geometry())[2];
+
  private:
-  std::unique_lock<std::mutex> lock_;
+  void WaitForBlock();
+  bool ReadBlock();
+  bool NextBlock();
+  void ResizeBeamformingBuffers();
+  void DelayChannels();
+  void SetSteeringVector(const SteeringVector &vector);
+  void ReapplySteering();
+  int16_t *Line(int channel) {
+    return &lines_[channel * (kBeamformingHistory + NumberOfSamples())];
+  }
+
+  MicrophoneBlockInfo block_info_;
+  MicrophoneOverrunStats overrun_stats_;
   //  delay and sum beamforming result
   std::valarray<int16_t> beamformed_;
-  std::valarray<int16_t> raw_data_;
-  std::valarray<int16_t> delayed_data_;
+  // FPGA block preceded by the bus read headroom; block_data_ points past it
+  std::valarray<int16_t> raw_buffer_;
+  int16_t *block_data_;
+  // Consecutive FPGA blocks gathered for block sizes above the FPGA's
+  std::valarray<int16_t> frame_;
+  // Current block: channel c starts at raw_data_ + c * raw_stride_
+  int16_t *raw_data_;
+  uint32_t raw_stride_;
+  uint32_t block_samples_;
+  // Samples of the FPGA block already delivered as sub-blocks
+  uint32_t sub_block_offset_;
   std::valarray<int16_t> fir_coeff_;
   int16_t gain_;
   uint32_t sampling_frequency_;
   bool enable_beamforming_;
 
-  // beamforming delay and sum support
-  std::valarray<CircularQueue<int16_t>> fifos_;
+  // beamforming delay and sum support. Each channel has a delay line of
+  // kBeamformingHistory samples from the previous block followed by the
+  // current block. delayed_[c] points into it for whole-sample delays, or
+  // to the channel's interpolated block in steered_.
+  std::valarray<int16_t> lines_;
+  std::valarray<int16_t> steered_;
+  int16_t *delayed_[kMicrophoneChannels];
+  SteeringVector steering_vector_;
+  SteeringVector previous_vector_;
+  bool crossfade_;
+  // Set by CalculateDelays and Steer, picked up by the next block
+  std::mutex steering_m_;
+  SteeringVector pending_vector_;
+  bool steering_pending_;
+
+  SteeringTable steering_table_;
+  int steering_grid_[2];
+  float steering_grid_source_[2];
+  // Last steering, reapplied when the board or sampling rate changes:
+  // a grid direction, or -1 and the CalculateDelays arguments
+  int steering_direction_;
+  float steering_[4];
 };
 };      // namespace matrix_hal
 #endif  // CPP_DRIVER_MICROPHONE_ARRAY_H_
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/realtime.h"
+#include <alloca.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+namespace matrix_hal {
+
+static size_t PageSize() {
+  long page = sysconf(_SC_PAGESIZE);
+  return page > 0 ? size_t(page) : 4096;
+}
+
+bool SetRealtimePriority(int priority, std::string *error) {
+  if (priority < 1 || priority > kRealtimeMaxPriority) {
+    if (error) *error = "invalid SCHED_FIFO priority";
+    return false;
+  }
+
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (result == 0) return true;
+
+  if (error) {
+    std::ostringstream os;
+    os << "can't set SCHED_FIFO priority " << priority << ": "
+       << strerror(result);
+    if (result == EPERM) {
+      struct rlimit limit;
+      os << " (needs root, CAP_SYS_NICE or an RLIMIT_RTPRIO of at least "
+         << priority;
+      if (getrlimit(RLIMIT_RTPRIO, &limit) == 0)
+        os << ", the current one is " << limit.rlim_cur;
+      os << ")";
+    }
+    *error = os.str();
+  }
+  return false;
+}
+
+bool PinThread(const std::vector<int> &cpus, std::string *error) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  const long online = sysconf(_SC_NPROCESSORS_CONF);
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE ||
+        (online > 0 && cpus[i] >= online)) {
+      if (error) {
+        std::ostringstream os;
+        os << "can't pin to CPU " << cpus[i] << ": this system has " << online;
+        *error = os.str();
+      }
+      return false;
+    }
+    CPU_SET(cpus[i], &set);
+  }
+
+  int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (result == 0) return true;
+
+  if (error) {
+    std::ostringstream os;
+    os << "can't set the CPU affinity: " << strerror(result);
+    if (result == EINVAL) os << " (CPUs offline or outside the cpuset)";
+    *error = os.str();
+  }
+  return false;
+}
+
+bool LockMemory(std::string *error) {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) return true;
+
+  int code = errno;
+  if (error) {
+    std::ostringstream os;
+    os << "can't lock the process memory: " << strerror(code);
+    if (code == EPERM || code == ENOMEM) {
+      struct rlimit limit;
+      os << " (needs root, CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK";
+      if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0) {
+        if (limit.rlim_cur == RLIM_INFINITY)
+          os << ", the current one is unlimited";
+        else
+          os << ", the current one is " << limit.rlim_cur / 1024 << " KiB";
+      }
+      os << ")";
+    }
+    *error = os.str();
+  }
+  return false;
+}
+
+// Not inlined: the alloca'd area has to be below the caller's frame
+void __attribute__((noinline)) PrefaultStack(size_t bytes) {
+  if (bytes == 0) return;
+  volatile unsigned char *stack = static_cast<unsigned char *>(alloca(bytes));
+  const size_t page = PageSize();
+  for (size_t i = 0; i < bytes; i += page) stack[i] = 0;
+  stack[bytes - 1] = 0;
+}
+
+bool ParseCpuList(const std::string &list, std::vector<int> *cpus) {
+  cpus->clear();
+  std::istringstream is(list);
+  std::string range;
+  while (std::getline(is, range, ',')) {
+    if (range.empty()) continue;
+    char *end;
+    long first = strtol(range.c_str(), &end, 10);
+    long last = first;
+    if (end == range.c_str()) return false;
+    if (*end == '-') {
+      const char *start = end + 1;
+      last = strtol(start, &end, 10);
+      if (end == start) return false;
+    }
+    if (*end != '\0' || first < 0 || last < first) return false;
+    for (long cpu = first; cpu <= last; cpu++) cpus->push_back(int(cpu));
+  }
+  return true;
+}
+
+bool ApplyRealtime(const RealtimeOptions &options, RealtimeStatus *status) {
+  RealtimeStatus local;
+  if (!status) status = &local;
+  std::string error;
+
+  // First, so that the prefaulted pages stay resident
+  if (options.lock_memory) {
+    status->memory_locked = LockMemory(&error);
+    if (!status->memory_locked) status->errors.push_back(error);
+  }
+
+  if (!options.cpus.empty()) {
+    status->affinity = PinThread(options.cpus, &error);
+    if (!status->affinity) status->errors.push_back(error);
+  }
+
+  if (options.priority > 0) {
+    status->scheduler = SetRealtimePriority(options.priority, &error);
+    if (!status->scheduler) status->errors.push_back(error);
+  }
+
+  PrefaultStack(options.prefault_stack_bytes);
+
+  for (size_t i = 0; i < status->errors.size(); i++)
+    std::cerr << "realtime: " << status->errors[i] << std::endl;
+
+  return status->errors.empty();
+}
+
+};  // namespace matrix_hal
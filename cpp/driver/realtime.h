@@ -0,0 +1,79 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_REALTIME_H_
+#define CPP_DRIVER_REALTIME_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace matrix_hal {
+
+// Highest SCHED_FIFO priority accepted, as on Linux
+const int kRealtimeMaxPriority = 99;
+
+// Scheduling profile of one thread. The defaults change nothing.
+struct RealtimeOptions {
+  RealtimeOptions()
+      : priority(0), lock_memory(false), prefault_stack_bytes(0) {}
+
+  // SCHED_FIFO priority in [1, kRealtimeMaxPriority]; 0 keeps the thread
+  // on the default time-sharing scheduler
+  int priority;
+  // CPUs the thread may run on; empty leaves the affinity alone
+  std::vector<int> cpus;
+  // mlockall(MCL_CURRENT | MCL_FUTURE): affects the whole process
+  bool lock_memory;
+  // Stack touched up front so the thread does not page fault later
+  size_t prefault_stack_bytes;
+};
+
+// What ApplyRealtime managed to do. |errors| has one line per failure,
+// saying which privilege or limit was missing.
+struct RealtimeStatus {
+  RealtimeStatus()
+      : scheduler(false), affinity(false), memory_locked(false) {}
+
+  bool scheduler;
+  bool affinity;
+  bool memory_locked;
+  std::vector<std::string> errors;
+};
+
+// Applies |options| to the calling thread. Failures are reported on
+// stderr, and in |status| when given, but the thread keeps running with
+// whatever could be applied. Returns true when everything asked for was
+// applied.
+bool ApplyRealtime(const RealtimeOptions &options,
+                   RealtimeStatus *status = NULL);
+
+// The single steps, for the calling thread; |error| is set on failure
+bool SetRealtimePriority(int priority, std::string *error);
+bool PinThread(const std::vector<int> &cpus, std::string *error);
+bool LockMemory(std::string *error);
+
+// Touches |bytes| of stack below the caller so the first real use of it
+// does not fault. Heap buffers need nothing of the kind once they have
+// been written, as the zeroing of AudioBlock and AudioBlockPool does.
+void PrefaultStack(size_t bytes);
+
+// Parses a CPU list such as "2", "2,3" or "0-1,3". Empty gives no CPUs.
+bool ParseCpuList(const std::string &list, std::vector<int> *cpus);
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_REALTIME_H_
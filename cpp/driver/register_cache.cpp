@@ -0,0 +1,159 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/register_cache.h"
+#include <string.h>
+#include "cpp/driver/creator_memory_map.h"
+
+namespace matrix_hal {
+
+// Shadowed windows of the configuration and GPIO blocks
+const uint16_t kConfShadowWords = 16;
+const uint16_t kGPIOShadowWords = 32;
+
+RegisterCache::RegisterCache() { SetDefaultPolicies(); }
+
+void RegisterCache::SetDefaultPolicies() {
+  // Identity, FPGA clock, microphone constant and gain, volume, PCM
+  // constant, mute and output selector.
+  SetPolicy(kConfBaseAddress, 12, kRegisterCacheable);
+  // Audio output FIFO flush strobe
+  SetPolicy(kConfBaseAddress + 12, 1, kRegisterWriteOnly);
+  SetPolicy(kConfBaseAddress + 13, kConfShadowWords - 13, kRegisterVolatile);
+
+  // Pin mode, pin values (inputs), pin function and prescalers
+  SetPolicy(kGPIOBaseAddress + 0, 1, kRegisterCacheable);
+  SetPolicy(kGPIOBaseAddress + 1, 1, kRegisterVolatile);
+  SetPolicy(kGPIOBaseAddress + 2, 2, kRegisterCacheable);
+  // PWM banks share their duty registers with the timer counters, and the
+  // IR receiver sits among them
+  SetPolicy(kGPIOBaseAddress + 4, 24, kRegisterVolatile);
+  // IR and ring IR outputs
+  SetPolicy(kGPIOBaseAddress + 28, 2, kRegisterWriteOnly);
+  SetPolicy(kGPIOBaseAddress + 30, kGPIOShadowWords - 30, kRegisterVolatile);
+}
+
+void RegisterCache::SetPolicy(uint16_t add, uint16_t words,
+                              RegisterPolicy policy) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  for (uint32_t w = add; w < uint32_t(add) + words; w++) {
+    Region *region = Find(w, sizeof(uint16_t));
+    if (!region) {
+      // Grow the region that ends right here, or start a new one
+      for (size_t r = 0; r < regions_.size() && !region; r++)
+        if (regions_[r].start + regions_[r].policy.size() == w)
+          region = &regions_[r];
+      if (!region) {
+        regions_.push_back(Region());
+        region = &regions_.back();
+        region->start = w;
+      }
+      region->policy.push_back(kRegisterVolatile);
+      region->valid.push_back(0);
+      region->value.push_back(0);
+    }
+    uint32_t i = w - region->start;
+    region->policy[i] = policy;
+    region->valid[i] = 0;
+  }
+}
+
+RegisterPolicy RegisterCache::Policy(uint16_t add) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Region *region = Find(add, sizeof(uint16_t));
+  if (!region) return kRegisterVolatile;
+  return RegisterPolicy(region->policy[add - region->start]);
+}
+
+RegisterCache::Region *RegisterCache::Find(uint16_t add, int length) {
+  uint32_t words = (length + 1) / 2;
+  for (size_t r = 0; r < regions_.size(); r++) {
+    Region &region = regions_[r];
+    if (add >= region.start &&
+        uint32_t(add) + words <= region.start + region.policy.size())
+      return &region;
+  }
+  return NULL;
+}
+
+bool RegisterCache::Lookup(uint16_t add, unsigned char *data, int length) {
+  if (length <= 0) return false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  Region *region = Find(add, length);
+  if (!region) return false;
+
+  uint32_t first = add - region->start;
+  uint32_t words = (length + 1) / 2;
+  for (uint32_t i = first; i < first + words; i++) {
+    if (region->policy[i] == kRegisterVolatile) return false;
+    if (region->policy[i] == kRegisterCacheable && !region->valid[i])
+      return false;
+  }
+  memcpy(data, &region->value[first], length);
+  return true;
+}
+
+void RegisterCache::Update(uint16_t add, const unsigned char *data,
+                           int length, bool written) {
+  if (length <= 0) return;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  Region *region = Find(add, length);
+  if (!region) return;
+
+  uint32_t first = add - region->start;
+  uint32_t words = length / 2;
+  for (uint32_t i = first; i < first + words; i++) {
+    bool keep = region->policy[i] == kRegisterCacheable ||
+                (written && region->policy[i] == kRegisterWriteOnly);
+    if (!keep) continue;
+    memcpy(&region->value[i], data + (i - first) * sizeof(uint16_t),
+           sizeof(uint16_t));
+    region->valid[i] = 1;
+  }
+}
+
+void RegisterCache::UpdateRead(uint16_t add, const unsigned char *data,
+                               int length) {
+  Update(add, data, length, false);
+}
+
+void RegisterCache::UpdateWrite(uint16_t add, const unsigned char *data,
+                                int length) {
+  Update(add, data, length, true);
+}
+
+void RegisterCache::Invalidate() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (size_t r = 0; r < regions_.size(); r++)
+    regions_[r].valid.assign(regions_[r].valid.size(), 0);
+}
+
+void RegisterCache::Invalidate(uint16_t add, int length) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint32_t end = uint32_t(add) + (length + 1) / 2;
+  for (size_t r = 0; r < regions_.size(); r++) {
+    Region &region = regions_[r];
+    for (uint32_t i = 0; i < region.valid.size(); i++) {
+      uint32_t w = region.start + i;
+      if (w >= add && w < end) region.valid[i] = 0;
+    }
+  }
+}
+};  // namespace matrix_hal
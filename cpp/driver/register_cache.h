@@ -0,0 +1,81 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_REGISTER_CACHE_H_
+#define CPP_DRIVER_REGISTER_CACHE_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+namespace matrix_hal {
+
+enum RegisterPolicy : uint8_t {
+  // Always read from the bus, the FPGA may change it on its own
+  kRegisterVolatile = 0,
+  // Only changes when written, reads are served from the shadow copy
+  kRegisterCacheable = 1,
+  // Strobes and setpoints that are never read back from the bus; reads
+  // return the last value written
+  kRegisterWriteOnly = 2
+};
+
+/*
+Write-through shadow copy of FPGA configuration registers. Addresses are
+word addresses, as on the bus; anything outside a declared region is
+treated as volatile.
+*/
+class RegisterCache {
+ public:
+  RegisterCache();
+
+  // Declares the policy of |words| registers starting at |add|.
+  void SetPolicy(uint16_t add, uint16_t words, RegisterPolicy policy);
+
+  RegisterPolicy Policy(uint16_t add);
+
+  // Copies the shadow of [add, add + length) into |data| when the whole
+  // range can be served without touching the bus.
+  bool Lookup(uint16_t add, unsigned char *data, int length);
+
+  // Records a value just read from the bus.
+  void UpdateRead(uint16_t add, const unsigned char *data, int length);
+
+  // Records a value just written to the bus.
+  void UpdateWrite(uint16_t add, const unsigned char *data, int length);
+
+  void Invalidate();
+  void Invalidate(uint16_t add, int length);
+
+ private:
+  struct Region {
+    uint16_t start;
+    std::vector<uint8_t> policy;
+    std::vector<uint8_t> valid;
+    std::vector<uint16_t> value;
+  };
+
+  Region *Find(uint16_t add, int length);
+  void Update(uint16_t add, const unsigned char *data, int length,
+              bool written);
+  void SetDefaultPolicies();
+
+  std::vector<Region> regions_;
+  std::mutex mutex_;
+};
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_REGISTER_CACHE_H_
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/sample_layout.h"
+#include <stdint.h>
+#include "cpp/driver/cpu_features.h"
+
+namespace matrix_hal {
+
+// The SIMD kernels handle eight channels, eight samples at a time
+static const int kTransposeSize = 8;
+
+typedef void (*InterleaveFunction)(const int16_t *const *, int, uint32_t,
+                                   int16_t *, uint32_t);
+typedef void (*DeinterleaveFunction)(const int16_t *, int, uint32_t,
+                                     int16_t *const *, uint32_t);
+
+// Convert samples [first, samples), the tail the vector kernels leave over
+static void InterleaveScalar(const int16_t *const *channels, int count,
+                             uint32_t samples, int16_t *out, uint32_t first) {
+  for (uint32_t s = first; s < samples; s++)
+    for (int c = 0; c < count; c++) out[s * count + c] = channels[c][s];
+}
+
+static void DeinterleaveScalar(const int16_t *in, int count, uint32_t samples,
+                               int16_t *const *channels, uint32_t first) {
+  for (uint32_t s = first; s < samples; s++)
+    for (int c = 0; c < count; c++) channels[c][s] = in[s * count + c];
+}
+
+#if defined(MATRIX_HAL_X86_KERNELS)
+// Transposes eight rows of eight samples in registers
+__attribute__((target("sse2"))) static inline void Transpose8x8SSE2(
+    __m128i *r) {
+  __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+  __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+  __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+  __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+  __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+__attribute__((target("sse2"))) static void InterleaveSSE2(
+    const int16_t *const *channels, int count, uint32_t samples, int16_t *out,
+    uint32_t first) {
+  uint32_t s = first;
+  if (count == kTransposeSize) {
+    for (; s + kTransposeSize <= samples; s += kTransposeSize) {
+      __m128i r[kTransposeSize];
+      for (int c = 0; c < kTransposeSize; c++)
+        r[c] =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(channels[c] + s));
+      Transpose8x8SSE2(r);
+      for (int i = 0; i < kTransposeSize; i++)
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(out + (s + i) * kTransposeSize), r[i]);
+    }
+  }
+  InterleaveScalar(channels, count, samples, out, s);
+}
+
+__attribute__((target("sse2"))) static void DeinterleaveSSE2(
+    const int16_t *in, int count, uint32_t samples, int16_t *const *channels,
+    uint32_t first) {
+  uint32_t s = first;
+  if (count == kTransposeSize) {
+    for (; s + kTransposeSize <= samples; s += kTransposeSize) {
+      __m128i r[kTransposeSize];
+      for (int i = 0; i < kTransposeSize; i++)
+        r[i] = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + (s + i) * kTransposeSize));
+      Transpose8x8SSE2(r);
+      for (int c = 0; c < kTransposeSize; c++)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(channels[c] + s), r[c]);
+    }
+  }
+  DeinterleaveScalar(in, count, samples, channels, s);
+}
+#endif
+
+#if defined(MATRIX_HAL_NEON_KERNEL)
+MATRIX_HAL_NEON_TARGET static inline void Transpose8x8NEON(int16x8_t *r) {
+  int16x8x2_t t0 = vtrnq_s16(r[0], r[1]);
+  int16x8x2_t t1 = vtrnq_s16(r[2], r[3]);
+  int16x8x2_t t2 = vtrnq_s16(r[4], r[5]);
+  int16x8x2_t t3 = vtrnq_s16(r[6], r[7]);
+
+  // Rows 0-3 of samples 0|4 and 2|6, then 1|5 and 3|7; likewise rows 4-7
+  int32x4x2_t u0 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[0]),
+                             vreinterpretq_s32_s16(t1.val[0]));
+  int32x4x2_t u1 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[1]),
+                             vreinterpretq_s32_s16(t1.val[1]));
+  int32x4x2_t u2 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[0]),
+                             vreinterpretq_s32_s16(t3.val[0]));
+  int32x4x2_t u3 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[1]),
+                             vreinterpretq_s32_s16(t3.val[1]));
+
+  r[0] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_low_s32(u0.val[0]), vget_low_s32(u2.val[0])));
+  r[1] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_low_s32(u1.val[0]), vget_low_s32(u3.val[0])));
+  r[2] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_low_s32(u0.val[1]), vget_low_s32(u2.val[1])));
+  r[3] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_low_s32(u1.val[1]), vget_low_s32(u3.val[1])));
+  r[4] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_high_s32(u0.val[0]), vget_high_s32(u2.val[0])));
+  r[5] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_high_s32(u1.val[0]), vget_high_s32(u3.val[0])));
+  r[6] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_high_s32(u0.val[1]), vget_high_s32(u2.val[1])));
+  r[7] = vreinterpretq_s16_s32(
+      vcombine_s32(vget_high_s32(u1.val[1]), vget_high_s32(u3.val[1])));
+}
+
+MATRIX_HAL_NEON_TARGET static void InterleaveNEON(
+    const int16_t *const *channels, int count, uint32_t samples, int16_t *out,
+    uint32_t first) {
+  uint32_t s = first;
+  if (count == kTransposeSize) {
+    for (; s + kTransposeSize <= samples; s += kTransposeSize) {
+      int16x8_t r[kTransposeSize];
+      for (int c = 0; c < kTransposeSize; c++) r[c] = vld1q_s16(channels[c] + s);
+      Transpose8x8NEON(r);
+      for (int i = 0; i < kTransposeSize; i++)
+        vst1q_s16(out + (s + i) * kTransposeSize, r[i]);
+    }
+  }
+  InterleaveScalar(channels, count, samples, out, s);
+}
+
+MATRIX_HAL_NEON_TARGET static void DeinterleaveNEON(
+    const int16_t *in, int count, uint32_t samples, int16_t *const *channels,
+    uint32_t first) {
+  uint32_t s = first;
+  if (count == kTransposeSize) {
+    for (; s + kTransposeSize <= samples; s += kTransposeSize) {
+      int16x8_t r[kTransposeSize];
+      for (int i = 0; i < kTransposeSize; i++)
+        r[i] = vld1q_s16(in + (s + i) * kTransposeSize);
+      Transpose8x8NEON(r);
+      for (int c = 0; c < kTransposeSize; c++) vst1q_s16(channels[c] + s, r[c]);
+    }
+  }
+  DeinterleaveScalar(in, count, samples, channels, s);
+}
+#endif
+
+struct SampleLayoutKernelEntry {
+  CpuFeature feature;
+  InterleaveFunction interleave;
+  DeinterleaveFunction deinterleave;
+  const char *name;
+};
+
+static const SampleLayoutKernelEntry kKernels[] = {
+#if defined(MATRIX_HAL_X86_KERNELS)
+    {kCpuSSE2, &InterleaveSSE2, &DeinterleaveSSE2, "sse2"},
+#endif
+#if defined(MATRIX_HAL_NEON_KERNEL)
+    {kCpuNEON, &InterleaveNEON, &DeinterleaveNEON, "neon"},
+#endif
+    {kCpuBaseline, &InterleaveScalar, &DeinterleaveScalar, "scalar"}};
+
+void Interleave(const int16_t *const *channels, int count, uint32_t samples,
+                int16_t *out) {
+  SelectKernel(kKernels).interleave(channels, count, samples, out, 0);
+}
+
+void Deinterleave(const int16_t *in, int count, uint32_t samples,
+                  int16_t *const *channels) {
+  SelectKernel(kKernels).deinterleave(in, count, samples, channels, 0);
+}
+
+const char *SampleLayoutKernel() { return SelectKernel(kKernels).name; }
+};  // namespace matrix_hal
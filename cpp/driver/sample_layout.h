@@ -0,0 +1,43 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_SAMPLE_LAYOUT_H_
+#define CPP_DRIVER_SAMPLE_LAYOUT_H_
+
+#include <stdint.h>
+
+namespace matrix_hal {
+
+enum SampleLayout {
+  kPlanar = 0,      // buffer[channel * samples + sample]
+  kInterleaved = 1  // buffer[sample * channels + channel]
+};
+
+// out[s * count + c] = channels[c][s]. Eight channels, the microphone
+// array, run on a SIMD transpose (SSE2 or NEON) picked on first use.
+void Interleave(const int16_t *const *channels, int count, uint32_t samples,
+                int16_t *out);
+
+// channels[c][s] = in[s * count + c], the inverse of Interleave
+void Deinterleave(const int16_t *in, int count, uint32_t samples,
+                  int16_t *const *channels);
+
+// Name of the kernel Interleave and Deinterleave run on this CPU
+const char *SampleLayoutKernel();
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_SAMPLE_LAYOUT_H_
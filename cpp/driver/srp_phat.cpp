@@ -0,0 +1,402 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/srp_phat.h"
+#include <algorithm>
+#include <cmath>
+
+namespace matrix_hal {
+
+static const double kPi = 3.14159265358979323846;
+
+// Below this magnitude a bin is treated as silent by PHAT
+static const float kSrpPhatFloor = 1e-12f;
+
+// Bins of the coarse grid, one out of every kSrpCoarseBinStride
+static const int kSrpCoarseBinStride = 4;
+
+// Default band, where speech has most of its energy
+static const float kSrpLowHz = 300.0f;
+static const float kSrpHighHz = 4000.0f;
+
+// Levels with fewer cells per thread than this run on the caller alone,
+// since waking the workers would cost more than it saves
+static const int kSrpMinCellsPerThread = 8;
+
+static float WrapAngle(float angle) {
+  return float(std::atan2(std::sin(angle), std::cos(angle)));
+}
+
+SrpPhat::SrpPhat()
+    : order_(0),
+      channels_(0),
+      sampling_frequency_(0),
+      sound_speed_mmseg_(0),
+      azimutal_steps_(0),
+      polar_steps_(0),
+      first_bin_(0),
+      last_bin_(0),
+      levels_(5),
+      in_(NULL),
+      spectra_(NULL),
+      coarse_bins_(0),
+      azimutal_angle_(0),
+      polar_angle_(0),
+      power_(0),
+      scratch_(1),
+      generation_(0),
+      pending_(0),
+      quit_(false),
+      next_cell_(0) {}
+
+SrpPhat::~SrpPhat() {
+  StopWorkers();
+  Release();
+}
+
+void SrpPhat::Release() {
+  forward_plan_.Release();
+
+  if (in_) fftwf_free(in_);
+  if (spectra_) fftwf_free(spectra_);
+
+  in_ = NULL;
+  spectra_ = NULL;
+  order_ = channels_ = 0;
+}
+
+bool SrpPhat::Init(int N, int channels, const float (*geometry)[2],
+                   uint32_t sampling_frequency, int azimutal_steps,
+                   int polar_steps, float sound_speed_mmseg) {
+  Release();
+  if (N < 8 || channels < 2 || sampling_frequency == 0 ||
+      azimutal_steps < 1 || polar_steps < 1 || sound_speed_mmseg <= 0)
+    return false;
+
+  order_ = N;
+  channels_ = channels;
+  sampling_frequency_ = sampling_frequency;
+  sound_speed_mmseg_ = sound_speed_mmseg;
+  azimutal_steps_ = azimutal_steps;
+  polar_steps_ = polar_steps;
+
+  geometry_.resize(2 * channels_);
+  for (int c = 0; c < channels_; c++) {
+    geometry_[2 * c] = geometry[c][0];
+    geometry_[2 * c + 1] = geometry[c][1];
+  }
+
+  in_ = (float *)fftwf_malloc(sizeof(float) * order_ * channels_);
+  if (!in_) return false;
+
+  const int bins = order_ / 2 + 1;
+  spectra_ =
+      (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * bins * channels_);
+  if (!spectra_) return false;
+
+  if (!forward_plan_.Init(kFFTRealToComplex, order_, channels_)) return false;
+
+  SetBand(int(std::ceil(kSrpLowHz * order_ / sampling_frequency_)),
+          int(kSrpHighHz * order_ / sampling_frequency_));
+  return true;
+}
+
+void SrpPhat::SetBand(int first_bin, int last_bin) {
+  if (!order_) return;
+  const int bins = order_ / 2 + 1;
+  first_bin_ = std::min(std::max(first_bin, 0), bins - 1);
+  last_bin_ = std::min(std::max(last_bin, first_bin_), bins - 1);
+
+  const int band = last_bin_ - first_bin_ + 1;
+  coarse_bins_ = (band - 1) / kSrpCoarseBinStride + 1;
+  real_.assign(channels_ * band, 0.0f);
+  imag_.assign(channels_ * band, 0.0f);
+  coarse_real_.assign(channels_ * coarse_bins_, 0.0f);
+  coarse_imag_.assign(channels_ * coarse_bins_, 0.0f);
+  for (size_t t = 0; t < scratch_.size(); t++)
+    scratch_[t].assign(ScratchSize(), 0.0f);
+
+  BuildTable();
+}
+
+bool SrpPhat::SetThreads(int threads) {
+  if (threads < 1) return false;
+  StopWorkers();
+
+  scratch_.assign(threads, std::vector<float>(ScratchSize(), 0.0f));
+  for (int t = 1; t < threads; t++)
+    workers_.push_back(
+        std::thread(&SrpPhat::WorkerThread, this, t, generation_));
+  return true;
+}
+
+int SrpPhat::ScratchSize() {
+  // Sums of every bin of the band, and the rotations of every channel
+  return 2 * (last_bin_ - first_bin_ + 1) + 4 * channels_;
+}
+
+float SrpPhat::GridAzimutalAngle(int index) {
+  return WrapAngle(float(2 * kPi * (index / polar_steps_) / azimutal_steps_));
+}
+
+float SrpPhat::GridPolarAngle(int index) {
+  // The normal itself is left out: every azimuth is the same there
+  return float(kPi / 2 * (index % polar_steps_ + 1) / polar_steps_);
+}
+
+void SrpPhat::BuildTable() {
+  const int cells = azimutal_steps_ * polar_steps_;
+  grid_power_.assign(cells, 0.0f);
+  steer_real_.resize(cells * channels_ * coarse_bins_);
+  steer_imag_.resize(cells * channels_ * coarse_bins_);
+
+  const double samples_per_mm = sampling_frequency_ / sound_speed_mmseg_;
+  for (int i = 0; i < cells; i++) {
+    const double azimutal = GridAzimutalAngle(i);
+    const double polar = GridPolarAngle(i);
+    const double ux = std::sin(polar) * std::cos(azimutal);
+    const double uy = std::sin(polar) * std::sin(azimutal);
+
+    for (int c = 0; c < channels_; c++) {
+      // The source reaches channel c |lead| samples early; its phase at
+      // bin k is cancelled by exp(-j 2 pi k lead / N)
+      const double lead =
+          (geometry_[2 * c] * ux + geometry_[2 * c + 1] * uy) * samples_per_mm;
+      float *real = &steer_real_[(i * channels_ + c) * coarse_bins_];
+      float *imag = &steer_imag_[(i * channels_ + c) * coarse_bins_];
+      for (int b = 0; b < coarse_bins_; b++) {
+        const int k = first_bin_ + b * kSrpCoarseBinStride;
+        const double phase = 2 * kPi * k * lead / order_;
+        real[b] = float(std::cos(phase));
+        imag[b] = float(-std::sin(phase));
+      }
+    }
+  }
+}
+
+void SrpPhat::Whiten() {
+  const int bins = order_ / 2 + 1;
+  const int band = last_bin_ - first_bin_ + 1;
+  for (int c = 0; c < channels_; c++) {
+    const fftwf_complex *x = &spectra_[c * bins + first_bin_];
+    float *real = &real_[c * band];
+    float *imag = &imag_[c * band];
+    for (int b = 0; b < band; b++) {
+      const float magnitude =
+          std::sqrt(x[b][0] * x[b][0] + x[b][1] * x[b][1]);
+      const float scale = magnitude > kSrpPhatFloor ? 1.0f / magnitude : 0.0f;
+      real[b] = x[b][0] * scale;
+      imag[b] = x[b][1] * scale;
+    }
+
+    float *coarse_real = &coarse_real_[c * coarse_bins_];
+    float *coarse_imag = &coarse_imag_[c * coarse_bins_];
+    for (int b = 0; b < coarse_bins_; b++) {
+      coarse_real[b] = real[b * kSrpCoarseBinStride];
+      coarse_imag[b] = imag[b * kSrpCoarseBinStride];
+    }
+  }
+}
+
+float SrpPhat::Evaluate(const Cell &cell, float *sum) {
+  const bool coarse = cell.index >= 0;
+  const int band =
+      coarse ? coarse_bins_ : (last_bin_ - first_bin_) / cell.stride + 1;
+  float *sum_real = sum;
+  float *sum_imag = sum + band;
+  std::fill(sum, sum + 2 * band, 0.0f);
+
+  if (coarse) {
+    for (int c = 0; c < channels_; c++) {
+      const float *xr = &coarse_real_[c * band];
+      const float *xi = &coarse_imag_[c * band];
+      const float *sr = &steer_real_[(cell.index * channels_ + c) * band];
+      const float *si = &steer_imag_[(cell.index * channels_ + c) * band];
+      for (int b = 0; b < band; b++) {
+        sum_real[b] += xr[b] * sr[b] - xi[b] * si[b];
+        sum_imag[b] += xr[b] * si[b] + xi[b] * sr[b];
+      }
+    }
+  } else {
+    // Steering phase of every channel at the first bin, and its rotation
+    // from one used bin to the next
+    float *sr = sum + 2 * band;
+    float *si = sr + channels_;
+    float *rotate_real = si + channels_;
+    float *rotate_imag = rotate_real + channels_;
+    const float ux = std::sin(cell.polar_angle) * std::cos(cell.azimutal_angle);
+    const float uy = std::sin(cell.polar_angle) * std::sin(cell.azimutal_angle);
+    const float samples_per_mm = sampling_frequency_ / sound_speed_mmseg_;
+    for (int c = 0; c < channels_; c++) {
+      const float lead =
+          (geometry_[2 * c] * ux + geometry_[2 * c + 1] * uy) * samples_per_mm;
+      const float step = float(2 * kPi / order_) * lead;
+      sr[c] = std::cos(step * first_bin_);
+      si[c] = -std::sin(step * first_bin_);
+      rotate_real[c] = std::cos(step * cell.stride);
+      rotate_imag[c] = -std::sin(step * cell.stride);
+    }
+
+    // Channels inside, so their rotations do not wait on each other
+    const int full_band = last_bin_ - first_bin_ + 1;
+    for (int b = 0; b < band; b++) {
+      const int k = b * cell.stride;
+      float real = 0.0f;
+      float imag = 0.0f;
+      for (int c = 0; c < channels_; c++) {
+        const float xr = real_[c * full_band + k];
+        const float xi = imag_[c * full_band + k];
+        real += xr * sr[c] - xi * si[c];
+        imag += xr * si[c] + xi * sr[c];
+        const float next = sr[c] * rotate_real[c] - si[c] * rotate_imag[c];
+        si[c] = sr[c] * rotate_imag[c] + si[c] * rotate_real[c];
+        sr[c] = next;
+      }
+      sum_real[b] = real;
+      sum_imag[b] = imag;
+    }
+  }
+
+  float power = 0.0f;
+  for (int b = 0; b < band; b++)
+    power += sum_real[b] * sum_real[b] + sum_imag[b] * sum_imag[b];
+  return power / (float(channels_) * channels_ * band);
+}
+
+void SrpPhat::Exec(const int16_t *const *channels) {
+  if (!forward_plan_.Valid()) return;
+
+  for (int c = 0; c < channels_; c++) {
+    const int16_t *x = channels[c];
+    float *in = &in_[c * order_];
+    for (int i = 0; i < order_; i++) in[i] = x[i];
+  }
+  forward_plan_.Execute(in_, spectra_);
+  Whiten();
+
+  // Coarse grid, from the table
+  const int cells = azimutal_steps_ * polar_steps_;
+  cells_.resize(cells);
+  for (int i = 0; i < cells; i++) {
+    cells_[i].azimutal_angle = GridAzimutalAngle(i);
+    cells_[i].polar_angle = GridPolarAngle(i);
+    cells_[i].index = i;
+    cells_[i].stride = kSrpCoarseBinStride;
+  }
+  RunCells();
+  grid_power_ = cell_power_;
+
+  int best = int(std::max_element(cell_power_.begin(), cell_power_.end()) -
+                 cell_power_.begin());
+  float azimutal = cells_[best].azimutal_angle;
+  float polar = cells_[best].polar_angle;
+  float power = cell_power_[best];
+
+  // Refinement: the best direction and its eight neighbours, at half the
+  // previous step each time. The centre is evaluated again so all nine
+  // are compared over the same bins: the coarse ones, and every bin on the
+  // last level.
+  float azimutal_step = float(2 * kPi / azimutal_steps_);
+  float polar_step = float(kPi / 2 / polar_steps_);
+  for (int level = 0; level < levels_; level++) {
+    azimutal_step /= 2;
+    polar_step /= 2;
+    cells_.clear();
+    for (int da = -1; da <= 1; da++) {
+      for (int dp = -1; dp <= 1; dp++) {
+        Cell cell;
+        cell.azimutal_angle = azimutal + da * azimutal_step;
+        cell.polar_angle = std::min(std::max(polar + dp * polar_step, 0.0f),
+                                    float(kPi / 2));
+        cell.index = -1;
+        cell.stride = level + 1 < levels_ ? kSrpCoarseBinStride : 1;
+        cells_.push_back(cell);
+      }
+    }
+    RunCells();
+
+    best = int(std::max_element(cell_power_.begin(), cell_power_.end()) -
+               cell_power_.begin());
+    azimutal = cells_[best].azimutal_angle;
+    polar = cells_[best].polar_angle;
+    power = cell_power_[best];
+  }
+
+  azimutal_angle_ = WrapAngle(azimutal);
+  polar_angle_ = polar;
+  power_ = power;
+}
+
+void SrpPhat::RunCells() {
+  const int count = int(cells_.size());
+  cell_power_.resize(count);
+  next_cell_ = 0;
+
+  const int threads = int(workers_.size()) + 1;
+  if (threads == 1 || count < kSrpMinCellsPerThread * threads) {
+    Work(0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = int(workers_.size());
+    generation_++;
+  }
+  start_cv_.notify_all();
+
+  Work(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void SrpPhat::Work(int worker) {
+  float *sum = scratch_[worker].data();
+  const int count = int(cells_.size());
+  for (int i = next_cell_++; i < count; i = next_cell_++)
+    cell_power_[i] = Evaluate(cells_[i], sum);
+}
+
+void SrpPhat::WorkerThread(int worker, uint64_t generation) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    start_cv_.wait(lock,
+                   [&] { return quit_ || generation_ != generation; });
+    if (quit_) return;
+    generation = generation_;
+
+    lock.unlock();
+    Work(worker);
+    lock.lock();
+
+    if (--pending_ == 0) done_cv_.notify_one();
+  }
+}
+
+void SrpPhat::StopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  start_cv_.notify_all();
+  for (size_t t = 0; t < workers_.size(); t++) workers_[t].join();
+  workers_.clear();
+  quit_ = false;
+}
+
+};  // namespace matrix_hal
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_SRP_PHAT_H_
+#define CPP_DRIVER_SRP_PHAT_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cpp/driver/fft_planner.h"
+
+namespace matrix_hal {
+
+/*
+Direction of arrival by steered response power with phase transform
+(SRP-PHAT). Every channel is transformed once per block and whitened, and
+the power of a direction is the energy over the band of the whitened
+spectra summed with the phases a far source there would cancel.
+
+A coarse grid of directions, with the steering phase of every channel and
+bin precomputed, finds the region of the source. Each refinement level
+then halves the grid step and looks at the eight directions around the
+best one so far, computing their phases on the fly. The coarse grid only
+needs every few bins: that aliases the correlations every N / stride
+lags, far beyond any delay across the array.
+*/
+class SrpPhat {
+ public:
+  SrpPhat();
+  ~SrpPhat();
+
+  // |geometry| holds the (x, y) position in mm of each of the |channels|
+  // microphones, see MicrophoneArray::Geometry. The coarse grid has
+  // |azimutal_steps| angles around the board and |polar_steps| angles
+  // from its normal up to the board plane.
+  bool Init(int N, int channels, const float (*geometry)[2],
+            uint32_t sampling_frequency, int azimutal_steps = 24,
+            int polar_steps = 4, float sound_speed_mmseg = 343 * 1000.0);
+  void Release();
+
+  // Only bins in [first_bin, last_bin] count; 300 Hz to 4 kHz by default
+  void SetBand(int first_bin, int last_bin);
+
+  // Refinement levels after the coarse grid, 5 by default: 15 degrees of
+  // coarse azimuth step end up below half a degree. All but the last use
+  // the coarse grid's bins.
+  void SetRefinement(int levels) { levels_ = levels < 0 ? 0 : levels; }
+
+  // Spreads the cells of large grid levels over |threads| threads, the
+  // caller's included. 1, the default, keeps all the work on the caller.
+  bool SetThreads(int threads);
+
+  // |channels|[c] points to N samples of channel c
+  void Exec(const int16_t *const *channels);
+
+  // Best direction of the last Exec, as in DirectionOfArrival: azimuth
+  // around the board and polar angle from its normal
+  float AzimutalAngle() { return azimutal_angle_; }
+  float PolarAngle() { return polar_angle_; }
+
+  // Power of that direction over the power of every channel in phase at
+  // every bin, in [0, 1]
+  float Power() { return power_; }
+
+  // Coarse grid of the last Exec, azimuth major
+  int AzimutalSteps() { return azimutal_steps_; }
+  int PolarSteps() { return polar_steps_; }
+  float GridAzimutalAngle(int index);
+  float GridPolarAngle(int index);
+  const std::vector<float> &GridPower() { return grid_power_; }
+
+ private:
+  struct Cell {
+    float azimutal_angle;
+    float polar_angle;
+    int index;  // in the precomputed table, or -1 to compute the phases
+    int stride;  // bins used, one out of every |stride|
+  };
+
+  int ScratchSize();
+  void BuildTable();
+  void Whiten();
+  float Evaluate(const Cell &cell, float *sum);
+  void RunCells();
+  void Work(int worker);
+  void WorkerThread(int worker, uint64_t generation);
+  void StopWorkers();
+
+  int order_;
+  int channels_;
+  uint32_t sampling_frequency_;
+  float sound_speed_mmseg_;
+  int azimutal_steps_;
+  int polar_steps_;
+  int first_bin_;
+  int last_bin_;
+  int levels_;
+  std::vector<float> geometry_;  // x, y of each channel
+
+  float *in_;
+  fftwf_complex *spectra_;
+  FFTPlan forward_plan_;
+
+  // Whitened band of every channel, real and imaginary parts apart, and
+  // every coarse stride-th bin of it packed for the coarse grid
+  std::vector<float> real_;
+  std::vector<float> imag_;
+  std::vector<float> coarse_real_;
+  std::vector<float> coarse_imag_;
+  int coarse_bins_;
+
+  // Steering phases of coarse cell i and channel c, coarse_bins_ each, at
+  // coarse_bins_ * (i * channels_ + c)
+  std::vector<float> steer_real_;
+  std::vector<float> steer_imag_;
+  std::vector<float> grid_power_;
+
+  float azimutal_angle_;
+  float polar_angle_;
+  float power_;
+
+  // Cells of the level being evaluated and their powers
+  std::vector<Cell> cells_;
+  std::vector<float> cell_power_;
+  // Per thread sums of the steered spectra, real then imaginary, and the
+  // steering phases of the cell
+  std::vector<std::vector<float> > scratch_;
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  uint64_t generation_;
+  int pending_;
+  bool quit_;
+  std::atomic<int> next_cell_;
+};
+
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_SRP_PHAT_H_
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Several threads write the same cacheable register over the simulated
+// bus, so writes are also coalesced into queued ones. After every round the
+// shadow has to hold what the FPGA holds, the bytes of the last transfer,
+// whichever writer returned last.
+
+#include <stdint.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpp/driver/creator_memory_map.h"
+#include "cpp/driver/matrixio_bus.h"
+
+namespace {
+
+const int kRounds = 2000;
+const int kWriters = 8;
+const int kWritesPerRound = 100;
+
+// Silent raw recording, 8 interleaved channels, for BusSimulated
+std::string WriteRecording() {
+  char path[] = "/tmp/register_cache_write_test_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) return "";
+  close(fd);
+  std::ofstream file(path, std::ios::binary);
+  std::vector<int16_t> frames(8 * 2048, 0);
+  file.write(reinterpret_cast<const char *>(frames.data()),
+             frames.size() * sizeof(int16_t));
+  return path;
+}
+
+}  // namespace
+
+int main() {
+  const std::string recording = WriteRecording();
+  if (recording.empty()) {
+    std::cerr << "can't create the recording" << std::endl;
+    return 1;
+  }
+
+  matrix_hal::MatrixIOBus bus;
+  if (!bus.Init(recording)) {
+    std::remove(recording.c_str());
+    return 1;
+  }
+
+  // Volume, cacheable by default
+  const uint16_t add = matrix_hal::kConfBaseAddress + 8;
+  int failures = 0;
+
+  for (int round = 0; round < kRounds; round++) {
+    std::thread writers[kWriters];
+    for (int w = 0; w < kWriters; w++) {
+      // Every writer has its own values
+      writers[w] = std::thread([&bus, add, w] {
+        for (int i = 0; i < kWritesPerRound; i++)
+          bus.Write(add, uint16_t(w << 12 | i));
+      });
+    }
+    for (int w = 0; w < kWriters; w++) writers[w].join();
+
+    uint16_t shadow = 0;
+    uint16_t device = 0;
+    bus.Read(add, &shadow);
+    bus.SetRegisterPolicy(add, 1, matrix_hal::kRegisterVolatile);
+    bus.Read(add, &device);
+    bus.SetRegisterPolicy(add, 1, matrix_hal::kRegisterCacheable);
+
+    if (shadow != device) {
+      std::cerr << "round " << round << ": shadow " << shadow << ", FPGA "
+                << device << std::endl;
+      failures++;
+    }
+  }
+
+  std::remove(recording.c_str());
+  std::cout << bus.ArbitrationStats().coalesced[matrix_hal::kBusPriorityControl]
+            << " writes coalesced" << std::endl;
+  if (failures) {
+    std::cerr << failures << " of " << kRounds << " rounds failed"
+              << std::endl;
+    return 1;
+  }
+  std::cout << "register cache follows the FPGA in " << kRounds << " rounds"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpp/driver/transfer_buffer.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace matrix_hal {
+
+TransferBuffer::TransferBuffer() : data_(NULL), size_(0) {}
+
+TransferBuffer::~TransferBuffer() { free(data_); }
+
+unsigned char *TransferBuffer::Reserve(size_t bytes) {
+  if (bytes <= size_) return data_;
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (bytes + page - 1) / page * page;
+  void *data;
+  if (posix_memalign(&data, page, size)) return NULL;
+
+  free(data_);
+  data_ = static_cast<unsigned char *>(data);
+  size_ = size;
+  return data_;
+}
+};  // namespace matrix_hal
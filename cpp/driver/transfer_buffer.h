@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 <Admobilize>
+ * MATRIX Labs  [http://creator.matrix.one]
+ * This file is part of MATRIX Creator HAL
+ *
+ * MATRIX Creator HAL is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPP_DRIVER_TRANSFER_BUFFER_H_
+#define CPP_DRIVER_TRANSFER_BUFFER_H_
+
+#include <stddef.h>
+
+namespace matrix_hal {
+
+/*
+Page-aligned staging memory for bus transfers. It starts empty and grows,
+in whole pages, to the largest size requested; it never shrinks.
+*/
+class TransferBuffer {
+ public:
+  TransferBuffer();
+  ~TransferBuffer();
+
+  // Returns at least |bytes| bytes, NULL if the allocation fails. Contents
+  // are not preserved when the buffer grows.
+  unsigned char *Reserve(size_t bytes);
+
+  unsigned char *Data() { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  TransferBuffer(const TransferBuffer &);
+  TransferBuffer &operator=(const TransferBuffer &);
+
+  unsigned char *data_;
+  size_t size_;
+};
+};      // namespace matrix_hal
+#endif  // CPP_DRIVER_TRANSFER_BUFFER_H_
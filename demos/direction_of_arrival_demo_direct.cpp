@@ -16,12 +16,24 @@
 #include "../cpp/driver/direction_of_arrival.h"
 #include "../cpp/driver/everloop.h"
 #include "../cpp/driver/everloop_image.h"
+#include "../cpp/driver/fft_planner.h"
 #include "../cpp/driver/matrixio_bus.h"
 #include "../cpp/driver/microphone_array.h"
 #include "../cpp/driver/microphone_core.h"
 
 DEFINE_bool(big_menu, true, "Include 'advanced' options in the menu listing");
 DEFINE_int32(sampling_frequency, 16000, "Sampling Frequency");
+DEFINE_bool(least_squares, false,
+            "Fit the GCC-PHAT delays of all microphone pairs instead of "
+            "picking the nearest microphone from the opposite pairs");
+DEFINE_bool(srp_phat, false,
+            "Search a grid of directions by steered response power (SRP-PHAT)");
+DEFINE_int32(doa_threads, 1, "Threads that share the SRP-PHAT search");
+DEFINE_string(fft_effort, "estimate",
+              "FFT planning: estimate, measure or patient. Measured plans "
+              "are faster but take a while to make the first time");
+DEFINE_string(fft_wisdom, "",
+              "File that keeps the measured FFT plans between runs");
 
 namespace hal = matrix_hal;
 
@@ -31,6 +43,14 @@ int lut[] = {1, 2, 10, 200, 10, 2, 1};
 int main(int argc, char *agrv[]) {
   google::ParseCommandLineFlags(&argc, &agrv, true);
 
+  hal::FFTPlanEffort effort;
+  if (!hal::ParseFFTPlanEffort(FLAGS_fft_effort, &effort)) {
+    std::cerr << "Unknown --fft_effort " << FLAGS_fft_effort << std::endl;
+    return 1;
+  }
+  hal::SetFFTPlanEffort(effort);
+  hal::SetFFTWisdomFile(FLAGS_fft_wisdom);
+
   hal::MatrixIOBus bus;
   if (!bus.Init()) return false;
 
@@ -55,6 +75,9 @@ int main(int argc, char *agrv[]) {
   mic_core.Setup(&bus);
 
   hal::DirectionOfArrival doa(mics);
+  if (FLAGS_least_squares) doa.SetMethod(hal::kDoaLeastSquares);
+  if (FLAGS_srp_phat) doa.SetMethod(hal::kDoaSrpPhat);
+  doa.SetThreads(FLAGS_doa_threads);
   doa.Init();
 
   float azimutal_angle;
@@ -14,6 +14,7 @@
 #include <iostream> // Standard I/O
 #include <fstream> // Input/output streams and functions
 #include <string> // Use strings
+#include <algorithm> // std::copy
 
 #include "../cpp/driver/matrixio_bus.h"     // Communicates with MATRIX device
 #include "../cpp/driver/microphone_array.h" // Interfaces with microphone array
@@ -120,10 +121,10 @@ int main(int argc, char *argv[])
             }
 
             // Copiar al buffer
-            for (uint32_t i = 0; i < num_samples; ++i) {
-                for (uint16_t ch = 0; ch < microphone_array.Channels(); ++ch) {
-                    mic_buffer[ch][samples + i] = microphone_array.At(i, ch);
-                }
+            for (uint16_t ch = 0; ch < microphone_array.Channels(); ++ch) {
+                const int16_t *channel = microphone_array.Channel(ch);
+                std::copy(channel, channel + num_samples,
+                          &mic_buffer[ch][samples]);
             }
 
             samples += num_samples;
@@ -11,7 +11,6 @@
 #include <fstream>
 #include <iostream>
 #include <string>
-#include <valarray>
 
 #include "../cpp/driver/everloop.h"
 #include "../cpp/driver/everloop_image.h"
@@ -50,17 +49,13 @@ int main() {
     }
   }
   int named_pipe_handle;
-  std::valarray<int16_t> buffer(mics.NumberOfSamples());
   while (true) {
     mics.Read(); /* Reading 8-mics buffer from de FPGA */
     for (uint16_t c = 0; c < mics.Channels(); c++) {
       std::string name = "/tmp/matrix_micarray_channel_" + std::to_string(c);
       named_pipe_handle = open(name.c_str(), O_WRONLY | O_NONBLOCK);
 
-      for (uint32_t s = 0; s < mics.NumberOfSamples(); s++)
-        buffer[s] = mics.At(s, c);
-
-      write(named_pipe_handle, &buffer[0],
+      write(named_pipe_handle, mics.Channel(c),
             sizeof(int16_t) * mics.NumberOfSamples());
       close(named_pipe_handle);
     }
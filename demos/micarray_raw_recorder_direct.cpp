@@ -8,6 +8,7 @@
 #include <gflags/gflags.h>
 #include <wiringPi.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -95,12 +96,12 @@ int main(int argc, char *agrv[]) {
       mics.Read(); /* Reading 8-mics buffer from de FPGA */
 
       /* buffering */
-      for (uint32_t s = 0; s < mics.NumberOfSamples(); s++) {
-        for (uint16_t c = 0; c < mics.Channels(); c++) { /* mics.Channels()=8 */
-          buffer[c][samples] = mics.Raw(s, c);
-        }
-        samples++;
+      for (uint16_t c = 0; c < mics.Channels(); c++) { /* mics.Channels()=8 */
+        const int16_t *channel = mics.RawChannel(c);
+        std::copy(channel, channel + mics.NumberOfSamples(),
+                  &buffer[c][samples]);
       }
+      samples += mics.NumberOfSamples();
 
       /* write to file */
       if (samples >= mics.SamplingRate()) {
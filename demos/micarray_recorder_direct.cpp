@@ -6,6 +6,7 @@
 #include <gflags/gflags.h>
 #include <wiringPi.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -95,13 +96,14 @@ int main(int argc, char *agrv[]) {
       mics.Read(); /* Reading 8-mics buffer from de FPGA */
 
       /* buffering */
-      for (uint32_t s = 0; s < mics.NumberOfSamples(); s++) {
-        for (uint16_t c = 0; c < mics.Channels(); c++) { /* mics.Channels()=8 */
-          buffer[c][samples] = mics.At(s, c);
-        }
-        buffer[mics.Channels()][samples] = mics.Beam(s);
-        samples++;
+      for (uint16_t c = 0; c < mics.Channels(); c++) { /* mics.Channels()=8 */
+        const int16_t *channel = mics.Channel(c);
+        std::copy(channel, channel + mics.NumberOfSamples(),
+                  &buffer[c][samples]);
       }
+      for (uint32_t s = 0; s < mics.NumberOfSamples(); s++)
+        buffer[mics.Channels()][samples + s] = mics.Beam(s);
+      samples += mics.NumberOfSamples();
 
       /* write to file */
       if (samples >= mics.SamplingRate()) {
@@ -12,6 +12,8 @@
 // Arrays for math operations
 #include <valarray>
 #include <chrono>
+// Copy channel blocks
+#include <algorithm>
 
 // Communicates with MATRIX device
 #include "../cpp/driver/matrixio_bus.h"
@@ -143,18 +145,15 @@ for (uint16_t c = 0; c < microphone_array.Channels(); c++) {
 
 
 
-    // For number of samples
-    for (uint32_t s = 0; s < microphone_array.NumberOfSamples(); s++) {
-        // For each microphone
-        for (uint16_t c = 0; c < microphone_array.Channels(); c++) {
+    // For each microphone
+    for (uint16_t c = 0; c < microphone_array.Channels(); c++) {
         // Send microphone data to buffer
-        buffer[c][samples] = microphone_array.At(s, c);
-        }
-        // Writes beamformed microphone data into buffer
-        //buffer[microphone_array.Channels()][samples] = microphone_array.Beam(s);
-        // Increment samples for buffer write
-        samples++;
+        const int16_t *channel = microphone_array.Channel(c);
+        std::copy(channel, channel + microphone_array.NumberOfSamples(),
+                  &buffer[c][samples]);
     }
+    // Increment samples for buffer write
+    samples += microphone_array.NumberOfSamples();
 
 
     size_t rows = sizeof(buffer) / sizeof(buffer[0]); // number of rows
@@ -0,0 +1,227 @@
+// FILE   : audio_block.hpp
+// AUTHOR : Julio Albisua
+// INFO   : Bloque de audio de todos los canales en una sola reserva alineada,
+//          con sus metadatos, y un pool de tamaño fijo para reciclarlos sin
+//          reservar memoria durante la captura
+
+#ifndef AUDIO_BLOCK_HPP
+#define AUDIO_BLOCK_HPP
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Planar block: channel c is samples() contiguous values at channel(c), and
+// the channels follow each other, so data() is what ReadInto(kPlanar) fills
+class AudioBlock {
+public:
+    // Cache line: the block never shares one with other data
+    static constexpr size_t kAlignment = 64;
+
+    uint64_t sequence = 0;  // position in the capture, 0 for the first one
+    std::chrono::steady_clock::time_point timestamp{};  // when it was read
+    uint32_t sample_rate = 0;
+
+    AudioBlock() = default;
+
+    AudioBlock(uint16_t channels, uint32_t samples)
+        : channels_(channels), samples_(samples), owned_(true) {
+        data_ = allocate(size());
+        // Also faults every page in now, not during the capture
+        std::memset(data_, 0, bytes());
+    }
+
+    AudioBlock(const AudioBlock &other) { *this = other; }
+
+    AudioBlock &operator=(const AudioBlock &other) {
+        if (this == &other) {
+            return *this;
+        }
+        // Same shape: copy in place, no allocation
+        if (size() != other.size()) {
+            release();
+            data_ = allocate(other.size());
+            owned_ = true;
+        }
+        channels_ = other.channels_;
+        samples_ = other.samples_;
+        copy_metadata(other);
+        if (other.size() > 0) {
+            std::memcpy(data_, other.data_, other.bytes());
+        }
+        return *this;
+    }
+
+    AudioBlock(AudioBlock &&other) noexcept { *this = std::move(other); }
+
+    AudioBlock &operator=(AudioBlock &&other) noexcept {
+        if (this != &other) {
+            release();
+            data_ = other.data_;
+            channels_ = other.channels_;
+            samples_ = other.samples_;
+            owned_ = other.owned_;
+            copy_metadata(other);
+            other.data_ = nullptr;
+            other.channels_ = 0;
+            other.samples_ = 0;
+            other.owned_ = false;
+        }
+        return *this;
+    }
+
+    ~AudioBlock() { release(); }
+
+    uint16_t channels() const { return channels_; }
+    uint32_t samples() const { return samples_; }  // per channel
+    size_t size() const { return size_t(channels_) * samples_; }
+    size_t bytes() const { return size() * sizeof(int16_t); }
+    bool empty() const { return size() == 0; }
+
+    int16_t *data() { return data_; }
+    const int16_t *data() const { return data_; }
+
+    int16_t *channel(uint16_t c) { return data_ + size_t(c) * samples_; }
+    const int16_t *channel(uint16_t c) const {
+        return data_ + size_t(c) * samples_;
+    }
+
+private:
+    friend class AudioBlockPool;
+
+    // View over memory owned by an AudioBlockPool
+    AudioBlock(int16_t *storage, uint16_t channels, uint32_t samples)
+        : data_(storage), channels_(channels), samples_(samples),
+          owned_(false) {}
+
+    static int16_t *allocate(size_t samples) {
+        if (samples == 0) {
+            return nullptr;
+        }
+        return static_cast<int16_t *>(::operator new(
+            samples * sizeof(int16_t), std::align_val_t(kAlignment)));
+    }
+
+    void release() {
+        if (owned_ && data_ != nullptr) {
+            ::operator delete(data_, std::align_val_t(kAlignment));
+        }
+        data_ = nullptr;
+        owned_ = false;
+    }
+
+    void copy_metadata(const AudioBlock &other) {
+        sequence = other.sequence;
+        timestamp = other.timestamp;
+        sample_rate = other.sample_rate;
+    }
+
+    int16_t *data_ = nullptr;
+    uint16_t channels_ = 0;
+    uint32_t samples_ = 0;
+    bool owned_ = false;
+};
+
+// Fixed set of blocks carved out of one slab. acquire() hands out a block
+// that goes back to the pool when its handle is destroyed, from any thread.
+// The pool must outlive every handle: declare it before the queues that
+// carry them.
+class AudioBlockPool {
+public:
+    struct Recycler {
+        AudioBlockPool *pool = nullptr;
+        void operator()(AudioBlock *block) const { pool->recycle(block); }
+    };
+    using Handle = std::unique_ptr<AudioBlock, Recycler>;
+
+    AudioBlockPool(size_t blocks, uint16_t channels, uint32_t samples)
+        : block_size_(size_t(channels) * samples) {
+        // Every block starts on its own cache line
+        const size_t align = AudioBlock::kAlignment / sizeof(int16_t);
+        stride_ = (block_size_ + align - 1) / align * align;
+        slab_ = AudioBlock::allocate(stride_ * blocks);
+        if (slab_ != nullptr) {
+            // Also faults every page in now, not during the capture
+            std::memset(slab_, 0, stride_ * blocks * sizeof(int16_t));
+        }
+
+        blocks_.reserve(blocks);
+        free_.reserve(blocks);
+        for (size_t i = 0; i < blocks; i++) {
+            blocks_.push_back(AudioBlock(slab_ + i * stride_, channels, samples));
+        }
+        for (auto &block : blocks_) {
+            free_.push_back(&block);
+        }
+    }
+
+    AudioBlockPool(const AudioBlockPool &) = delete;
+    AudioBlockPool &operator=(const AudioBlockPool &) = delete;
+
+    ~AudioBlockPool() {
+        if (slab_ != nullptr) {
+            ::operator delete(slab_, std::align_val_t(AudioBlock::kAlignment));
+        }
+    }
+
+    // Waits up to |timeout| for a free block; an empty handle if none came
+    Handle acquire(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cond_.wait_for(lock, timeout, [&] { return !free_.empty(); })) {
+            return Handle(nullptr, Recycler{this});
+        }
+        return take();
+    }
+
+    // Never waits: an empty handle if every block is in use
+    Handle try_acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            return Handle(nullptr, Recycler{this});
+        }
+        return take();
+    }
+
+    size_t size() const { return blocks_.size(); }
+
+    size_t available() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+private:
+    Handle take() {
+        AudioBlock *block = free_.back();
+        free_.pop_back();
+        return Handle(block, Recycler{this});
+    }
+
+    void recycle(AudioBlock *block) {
+        block->sequence = 0;
+        block->timestamp = {};
+        block->sample_rate = 0;
+        {
+            // Reserved for every block, push_back never allocates
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(block);
+        }
+        cond_.notify_one();
+    }
+
+    size_t block_size_;
+    size_t stride_ = 0;
+    int16_t *slab_ = nullptr;
+    std::vector<AudioBlock> blocks_;
+    std::vector<AudioBlock *> free_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+using PooledAudioBlock = AudioBlockPool::Handle;
+
+#endif
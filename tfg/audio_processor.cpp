@@ -5,10 +5,13 @@
 //           y se enciende el led más cercano a la DOA calculada
 
 #include "audio_processor.hpp"
-#include "queue.hpp"
+#include "audio_block.hpp"
+#include "broadcast_ring.hpp"
+#include "pipeline.hpp"
 #include <algorithm>
 #include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
@@ -74,101 +77,173 @@ void write_wav_header(
     }
 }
 
-void capture_audio(matrix_hal::MicrophoneArray *mic_array,
-                   SafeQueue<AudioBlock> &queue, std::atomic_bool &running) {
-  const uint32_t BLOCK_SIZE = mic_array->NumberOfSamples();
-  const uint16_t CHANNELS = mic_array->Channels();
+// Reads one block straight into |block|, which must already have the
+// array's shape: the driver writes the planar samples in place
+static bool read_audio_block(matrix_hal::MicrophoneArray *mic_array,
+                             AudioBlock &block, uint64_t sequence) {
+  if (block.channels() != mic_array->Channels() ||
+      block.samples() != mic_array->NumberOfSamples()) {
+    std::cerr << "Error: el bloque no tiene la forma del array de micrófonos"
+              << std::endl;
+    return false;
+  }
+  if (!mic_array->ReadInto(block.data(), matrix_hal::kPlanar)) {
+    return false;
+  }
+  block.sequence = sequence;
+  block.timestamp = std::chrono::steady_clock::now();
+  block.sample_rate = mic_array->SamplingRate();
+  return true;
+}
 
-  while (running) {
-    mic_array->Read();
-    AudioBlock block;
-    block.samples.resize(CHANNELS, std::vector<int16_t>(BLOCK_SIZE));
-    for (uint32_t s = 0; s < BLOCK_SIZE; ++s) {
-      for (uint16_t ch = 0; ch < CHANNELS; ++ch) {
-        block.samples[ch][s] = mic_array->At(s, ch);
-      }
-    }
-    queue.push(block);
+static void report_overruns(matrix_hal::MicrophoneArray *mic_array) {
+  // Blocks the FPGA produced while we were still busy with the previous one
+  matrix_hal::MicrophoneOverrunStats overruns = mic_array->OverrunStats();
+  if (overruns.blocks_missed > 0) {
+    std::cerr << "Aviso: se han perdido " << overruns.blocks_missed
+              << " bloques de audio de " << overruns.blocks_read
+              << " leidos (" << overruns.overruns << " desbordamientos)"
+              << std::endl;
   }
 }
 
-void record_all_channels_wav(SafeQueue<AudioBlock> &queue,
-                             matrix_hal::MicrophoneArray *mic_array,
+void capture_audio_broadcast(matrix_hal::MicrophoneArray *mic_array,
+                             BroadcastRing<AudioBlock> &ring,
                              std::atomic_bool &running,
-                             std::string filename_without_extension = "output",
-                             bool drain = true) {
-  // const uint16_t NUM_CHANNELS = mic_array->Channels();
-  constexpr uint16_t NUM_CHANNELS_ = 8; // Hardcoded because we need constexpr
-  const uint32_t frequency = mic_array->SamplingRate();
-  const uint32_t BITS_PER_SAMPLE = 16;
-  const uint32_t WAV_CHANNELS = 1;
+                             const matrix_hal::RealtimeOptions &realtime) {
+  uint64_t sequence = 0;
 
-  std::array<std::string, NUM_CHANNELS_> filenames;
-  std::array<std::ofstream, NUM_CHANNELS_> filehandles;
+  matrix_hal::ApplyRealtime(realtime);
 
-  for (size_t i = 0; i < NUM_CHANNELS_; i++) {
+  while (running) {
+    // The slot is filled in place and shared by every consumer
+    AudioBlock *block = ring.acquire();
+    if (block == nullptr) {
+      break;
+    }
+    if (!read_audio_block(mic_array, *block, sequence)) {
+      continue;
+    }
+    sequence++;
+    ring.publish();
+  }
+
+  report_overruns(mic_array);
+}
+
+constexpr uint16_t WAV_FILES = 8; // Hardcoded because we need constexpr
+
+static bool open_channel_wavs(std::array<std::ofstream, WAV_FILES> &filehandles,
+                              std::string filename_without_extension) {
+  for (size_t i = 0; i < WAV_FILES; i++) {
     std::string wavname =
         filename_without_extension + "_ch_" + std::to_string(i + 1) + ".wav";
-    filenames[i] = wavname;
 
     filehandles[i] = std::ofstream(wavname, std::ios::binary);
     if (!filehandles[i].is_open()) {
       std::cerr << "Error abriendo " << wavname << "para grabar" << std::endl;
-      return;
+      return false;
     }
   }
+  return true;
+}
+
+static void append_block_wav(std::array<std::ofstream, WAV_FILES> &filehandles,
+                             std::array<uint32_t, WAV_FILES> &audio_lens,
+                             const AudioBlock &block, uint32_t frequency) {
+  const uint32_t BITS_PER_SAMPLE = 16;
+  const uint32_t WAV_CHANNELS = 1;
 
-  std::array<uint32_t, NUM_CHANNELS_>  audio_lens = {0,0,0,0,0,0,0,0};
+  const uint32_t channel_bytes = block.samples() * sizeof(int16_t);
+
+  for (size_t i = 0; i < WAV_FILES && i < block.channels(); i++) {
+    audio_lens[i] = audio_lens[i] + channel_bytes;
+    write_wav_header(filehandles[i], frequency, BITS_PER_SAMPLE, WAV_CHANNELS,
+                     audio_lens[i]);
+
+    // Write inside the while(running) loop, that way we write all the
+    // data as soon as we can take it. Also Write automatically advances the
+    // handle
+    filehandles[i].write(reinterpret_cast<const char *>(block.channel(i)),
+                         channel_bytes);
+  }
+}
 
-  // Continue processing while running = true, or we want to drain all the
-  // data in the queue, which has data. If we don't drain we can leave the
-  // queue with data at the end of the process.
-  while (running || (drain && !queue.empty())) {
-    AudioBlock block;
-    // This thread is going to sleep until we have an element in the queue, if
-    // it's empty
-    int ret_pop = queue.wait_pop(block);
+void record_all_channels_wav_broadcast(BroadcastRing<AudioBlock> &ring,
+                                       int consumer,
+                                       matrix_hal::MicrophoneArray *mic_array,
+                                       std::atomic_bool &running,
+                                       std::string filename_without_extension,
+                                       bool drain) {
+  std::array<std::ofstream, WAV_FILES> filehandles;
+  if (!open_channel_wavs(filehandles, filename_without_extension)) {
+    ring.unsubscribe(consumer);
+    return;
+  }
+
+  std::array<uint32_t, WAV_FILES>  audio_lens = {0,0,0,0,0,0,0,0};
+
+  while (running || (drain && !ring.empty(consumer))) {
+    BroadcastRing<AudioBlock>::Ref block;
+    int ret_pop = ring.wait_pop(consumer, block);
     if (ret_pop == 0) {
-        continue; // We are not running and we have no more data in the queue.
+        continue;
     }
+    append_block_wav(filehandles, audio_lens, *block,
+                     mic_array->SamplingRate());
+  }
+}
 
-    uint32_t block_size = block.samples[0].size();
-    std::vector<std::vector<int16_t>> audios(
-        NUM_CHANNELS_, std::vector<int16_t>(block_size, 0));
-
-    for (size_t i = 0; i < NUM_CHANNELS_; i++) {
-      std::vector<int16_t> ch_audio(block.samples[i]);
-      audio_lens[i] = audio_lens[i] + ch_audio.size() * sizeof(int16_t);
-      write_wav_header(filehandles[i], frequency, BITS_PER_SAMPLE, WAV_CHANNELS,
-                       audio_lens[i]);
-
-      // Write inside the while(running) loop, that way we write all the
-      // data as soon as we can take it. Also Write automatically advances the
-      // handle
-      filehandles[i].write(reinterpret_cast<const char *>(ch_audio.data()),
-                           ch_audio.size() * sizeof(int16_t));
+std::function<SourceStatus(PooledAudioBlock &)>
+audio_capture_stage(matrix_hal::MicrophoneArray *mic_array,
+                    AudioBlockPool &pool) {
+  auto sequence = std::make_shared<uint64_t>(0);
+  return [mic_array, &pool, sequence](PooledAudioBlock &block) {
+    using namespace std::chrono_literals;
+    // Only waits if the pool is smaller than the queues that hold blocks
+    block = pool.acquire(100ms);
+    if (!block || !read_audio_block(mic_array, *block, *sequence)) {
+      block.reset();
+      return SourceStatus::Skip;
     }
-  }
+    (*sequence)++;
+    return SourceStatus::Item;
+  };
+}
+
+std::function<void(PooledAudioBlock &)>
+wav_channels_stage(matrix_hal::MicrophoneArray *mic_array,
+                   std::string filename_without_extension) {
+  struct WavFiles {
+    std::array<std::ofstream, WAV_FILES> filehandles;
+    std::array<uint32_t, WAV_FILES> audio_lens = {0, 0, 0, 0, 0, 0, 0, 0};
+    bool open = false;
+  };
+  auto files = std::make_shared<WavFiles>();
+  files->open = open_channel_wavs(files->filehandles, filename_without_extension);
+
+  const uint32_t frequency = mic_array->SamplingRate();
+  return [files, frequency](PooledAudioBlock &block) {
+    if (files->open) {
+      append_block_wav(files->filehandles, files->audio_lens, *block,
+                       frequency);
+    }
+  };
 }
 
 AudioBlock capture_audio_sync(matrix_hal::MicrophoneArray *mic_array) {
-    const uint32_t BLOCK_SIZE = mic_array->NumberOfSamples();
-    const uint16_t CHANNELS = mic_array->Channels();
-
-    mic_array->Read();
-    AudioBlock block;
-    block.samples.resize(CHANNELS, std::vector<int16_t>(BLOCK_SIZE));
-    for (uint32_t s = 0; s < BLOCK_SIZE; ++s) {
-        for (uint16_t ch = 0; ch < CHANNELS; ++ch) {
-            block.samples[ch][s] = mic_array->At(s, ch);
-        }
+    static uint64_t sequence = 0;
+
+    AudioBlock block(mic_array->Channels(), mic_array->NumberOfSamples());
+    if (read_audio_block(mic_array, block, sequence)) {
+        sequence++;
     }
 
     return block;
 }
 
 void record_all_channels_wav_sync(matrix_hal::MicrophoneArray *mic_array,
-                                  AudioBlock data,
+                                  const AudioBlock &data,
                                   std::string filename_without_extension) {
   const uint32_t frequency = mic_array->SamplingRate();
   const uint32_t BITS_PER_SAMPLE = 16;
@@ -229,12 +304,11 @@ void record_all_channels_wav_sync(matrix_hal::MicrophoneArray *mic_array,
         reinterpret_cast<const char *>(initial_data[i].data()),
         initial_data[i].size() * sizeof(char));
 
-    std::vector<int16_t> new_audio{data.samples[i]};
-    uint32_t new_audio_len = new_audio.size() * sizeof(int16_t);
+    uint32_t new_audio_len = data.samples() * sizeof(int16_t);
     write_wav_header(
         filehandles_out[i], frequency, BITS_PER_SAMPLE, WAV_CHANNELS,
         new_audio_len + initial_size_with_header[i] - WAV_HEADER_LEN);
-    filehandles_out[i].write(reinterpret_cast<const char *>(new_audio.data()),
+    filehandles_out[i].write(reinterpret_cast<const char *>(data.channel(i)),
                              new_audio_len);
   }
 }
@@ -272,7 +346,7 @@ bool disconnect_sync_mqtt_client(mqtt::client &client) {
 }
 
 void send_audio_mqtt_sync(mqtt::client &client,
-                    matrix_hal::MicrophoneArray *mic_array, AudioBlock block,
+                    matrix_hal::MicrophoneArray *mic_array, const AudioBlock &block,
                     std::string topic_name, int qos = 1,
                     bool send_bytes = true) {
   const uint16_t NUM_CHANNELS = mic_array->Channels();
@@ -280,16 +354,17 @@ void send_audio_mqtt_sync(mqtt::client &client,
   try {
     for (size_t i = 0; i < NUM_CHANNELS; i++) {
       std::string topic = topic_name + "_" + std::to_string(i + 1);
-      auto data = block.samples[i];
+      const int16_t *data = block.channel(i);
+      const uint32_t samples = block.samples();
 
       std::stringstream ds;
       ds << "[";
 
-      for (auto &d : data) {
-        ds << d << ", ";
+      for (uint32_t s = 0; s < samples; s++) {
+        ds << data[s] << ", ";
       }
 
-      if (!data.empty()) {
+      if (samples > 0) {
         ds.seekp(-1, ds.cur); // Delete last space (' ')
       }
       ds << "]";
@@ -297,8 +372,8 @@ void send_audio_mqtt_sync(mqtt::client &client,
       mqtt::message_ptr pubmsg;
       if (send_bytes) {
         pubmsg = mqtt::make_message(topic,
-                                    reinterpret_cast<const char *>(data.data()),
-                                    data.size() * sizeof(int16_t));
+                                    reinterpret_cast<const char *>(data),
+                                    samples * sizeof(int16_t));
       } else {
         pubmsg = mqtt::make_message(topic, ds.str());
       }
@@ -362,57 +437,61 @@ bool disconnect_async_mqtt_client(mqtt::async_client &client, AsyncMQTTOptions o
   return true;
 }
 
-void send_audio_mqtt_async(matrix_hal::MicrophoneArray *mic_array,
-                     SafeQueue<AudioBlock> &queue, std::atomic_bool &running,
-                     AsyncMQTTOptions mqtt_options, bool drain = true) {
-
-  const uint16_t NUM_CHANNELS = mic_array->Channels();
-
-  mqtt::async_client client{mqtt_options.ip + ":" + mqtt_options.port ,mqtt_options.clientID};
-  connect_async_mqtt_client(client, mqtt_options);
-
-  while (running || (drain && !queue.empty())) {
-    AudioBlock block;
-
-    int ret = queue.wait_pop(block);
-    if (ret == 0) {
-      continue;
-    }
-
-    for (size_t i = 0; i < NUM_CHANNELS; i++) {
-      std::string topic =
-          mqtt_options.base_topic_name + "_" + std::to_string(i + 1);
-      auto data_vec = block.samples[i];
-
+static void publish_block_mqtt_async(mqtt::async_client &client,
+                                     const AudioBlock &block,
+                                     const AsyncMQTTOptions &mqtt_options) {
+  const uint32_t samples = block.samples();
+
+  for (uint16_t i = 0; i < block.channels(); i++) {
+    std::string topic =
+        mqtt_options.base_topic_name + "_" + std::to_string(i + 1);
+    const int16_t *data = block.channel(i);
+
+    mqtt::message_ptr pubmsg;
+    if (mqtt_options.send_bytes) {
+      pubmsg = mqtt::make_message(
+          topic, reinterpret_cast<const char *>(data),
+          samples * sizeof(int16_t));
+    } else {
       std::stringstream data_string;
       data_string << "[";
 
-      for (auto &d : data_vec) {
-        data_string << d << ", ";
+      for (uint32_t s = 0; s < samples; s++) {
+        data_string << data[s] << ", ";
       }
 
-      if (!data_vec.empty()) {
+      if (samples > 0) {
         data_string.seekp(-1, data_string.cur); // Delete last space (' ')
       }
       data_string << "]";
+      pubmsg = mqtt::make_message(topic, data_string.str());
+    }
 
-      mqtt::message_ptr pubmsg;
-      if (mqtt_options.send_bytes) {
-        pubmsg = mqtt::make_message(
-            topic, reinterpret_cast<const char *>(data_vec.data()),
-            data_vec.size() * sizeof(int16_t));
-      } else {
-        pubmsg = mqtt::make_message(topic, data_string.str());
-      }
-
-      try {
-        pubmsg->set_qos(mqtt_options.qos);
-        client.publish(pubmsg);
-      } catch (const mqtt::exception &exc) {
-        std::cerr << "Async MQTT publish error" << exc.what() << std::endl;
-      }
+    try {
+      pubmsg->set_qos(mqtt_options.qos);
+      client.publish(pubmsg);
+    } catch (const mqtt::exception &exc) {
+      std::cerr << "Async MQTT publish error" << exc.what() << std::endl;
     }
   }
+}
+
+std::function<void(PooledAudioBlock &)>
+mqtt_publish_stage(AsyncMQTTOptions mqtt_options) {
+  // Disconnects, sending what is pending, when the last copy of the stage
+  // goes away
+  struct Publisher {
+    AsyncMQTTOptions options;
+    mqtt::async_client client;
+    explicit Publisher(AsyncMQTTOptions opts)
+        : options(opts), client(opts.ip + ":" + opts.port, opts.clientID) {
+      connect_async_mqtt_client(client, options);
+    }
+    ~Publisher() { disconnect_async_mqtt_client(client, options); }
+  };
+  auto publisher = std::make_shared<Publisher>(mqtt_options);
 
-  disconnect_async_mqtt_client(client, mqtt_options);
+  return [publisher](PooledAudioBlock &block) {
+    publish_block_mqtt_async(publisher->client, *block, publisher->options);
+  };
 }
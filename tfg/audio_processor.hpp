@@ -5,9 +5,13 @@
 //           y se enciende el led más cercano a la DOA calculada
 
 #include "../cpp/driver/microphone_array.h"
+#include "../cpp/driver/realtime.h"
 #include "mqtt/client.h"
-#include "queue.hpp"
+#include "audio_block.hpp"
+#include "broadcast_ring.hpp"
+#include "pipeline.hpp"
 #include <atomic>
+#include <functional>
 
 struct AsyncMQTTOptions {
 public:
@@ -75,21 +79,33 @@ public:
   }
 };
 
-void capture_audio(matrix_hal::MicrophoneArray *mic_array,
-                   SafeQueue<AudioBlock> &queue, std::atomic_bool &running);
+// Captura una sola vez para todos los consumidores del anillo
+void capture_audio_broadcast(matrix_hal::MicrophoneArray *mic_array,
+                             BroadcastRing<AudioBlock> &ring,
+                             std::atomic_bool &running,
+                             const matrix_hal::RealtimeOptions &realtime);
+
+// Etapas para Pipeline: captura, grabación WAV por canal y envío MQTT. El
+// estado (ficheros, cliente) va dentro de la función y se libera con ella.
+std::function<SourceStatus(PooledAudioBlock &)>
+audio_capture_stage(matrix_hal::MicrophoneArray *mic_array,
+                    AudioBlockPool &pool);
+
+std::function<void(PooledAudioBlock &)>
+wav_channels_stage(matrix_hal::MicrophoneArray *mic_array,
+                   std::string filename_without_extension = "output");
+
+std::function<void(PooledAudioBlock &)>
+mqtt_publish_stage(AsyncMQTTOptions mqtt_options);
 
 void write_wav_header(std::ofstream &out, uint32_t sample_rate,
                       uint16_t bits_per_sample, uint16_t num_channels,
                       uint32_t data_size);
 
-void send_audio_mqtt_async(matrix_hal::MicrophoneArray *mic_array,
-                           SafeQueue<AudioBlock> &queue,
-                           std::atomic_bool &running,
-                           AsyncMQTTOptions mqtt_options, bool drain);
-
 void send_audio_mqtt_sync(mqtt::client &client,
                           matrix_hal::MicrophoneArray *mic_array,
-                          AudioBlock block, std::string topic_name, int qos,
+                          const AudioBlock &block, std::string topic_name,
+                          int qos,
                           bool send_bytes);
 
 bool disconnect_sync_mqtt_client(mqtt::client &client);
@@ -98,13 +114,14 @@ bool connect_sync_mqtt_client(mqtt::client &client,
                               mqtt::connect_options *conn_opts);
 
 void record_all_channels_wav_sync(matrix_hal::MicrophoneArray *mic_array,
-                                  AudioBlock data,
+                                  const AudioBlock &data,
                                   std::string filename_without_extension);
 
 AudioBlock capture_audio_sync(matrix_hal::MicrophoneArray *mic_array);
 
-void record_all_channels_wav(SafeQueue<AudioBlock> &queue,
-                             matrix_hal::MicrophoneArray *mic_array,
-                             std::atomic_bool &running,
-                             std::string filename_without_extension,
-                             bool drain);
+void record_all_channels_wav_broadcast(BroadcastRing<AudioBlock> &ring,
+                                       int consumer,
+                                       matrix_hal::MicrophoneArray *mic_array,
+                                       std::atomic_bool &running,
+                                       std::string filename_without_extension = "output",
+                                       bool drain = true);
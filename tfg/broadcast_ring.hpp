@@ -0,0 +1,244 @@
+// FILE   : broadcast_ring.hpp
+// AUTHOR : Julio Albisua
+// INFO   : Anillo de difusión: un productor y varios consumidores comparten
+//          los mismos bloques preasignados, sin copias por consumidor.
+//          Cada consumidor tiene su propio cursor, su retraso y su política
+//          (bloquear al productor o perder los bloques más antiguos)
+
+#ifndef BROADCAST_RING_HPP
+#define BROADCAST_RING_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class BroadcastRing {
+public:
+    // What the producer does when this consumer is a whole ring behind
+    enum class Policy {
+        Block,      // wait for it, the consumer loses nothing
+        DropOldest  // move its cursor forward, it loses the oldest blocks
+    };
+
+    struct ConsumerStats {
+        uint64_t read = 0;
+        uint64_t dropped = 0;
+        uint64_t lag = 0;      // blocks published but not read yet
+        uint64_t max_lag = 0;
+    };
+
+    // Read-only handle to a block. While it lives the producer can not
+    // reuse the slot, so release it (or let it go out of scope) soon.
+    class Ref {
+    public:
+        Ref() = default;
+        Ref(const Ref &) = delete;
+        Ref &operator=(const Ref &) = delete;
+        Ref(Ref &&other) noexcept { *this = std::move(other); }
+        Ref &operator=(Ref &&other) noexcept {
+            if (this != &other) {
+                release();
+                ring_ = other.ring_;
+                slot_ = other.slot_;
+                sequence_ = other.sequence_;
+                other.ring_ = nullptr;
+            }
+            return *this;
+        }
+        ~Ref() { release(); }
+
+        void release() {
+            if (ring_ != nullptr) {
+                ring_->unpin(slot_);
+                ring_ = nullptr;
+            }
+        }
+
+        explicit operator bool() const { return ring_ != nullptr; }
+        const T &operator*() const { return ring_->slots_[slot_].value; }
+        const T *operator->() const { return &ring_->slots_[slot_].value; }
+        // Position of the block in the stream, 0 for the first one published
+        uint64_t sequence() const { return sequence_; }
+
+    private:
+        friend class BroadcastRing;
+        Ref(BroadcastRing *ring, size_t slot, uint64_t sequence)
+            : ring_(ring), slot_(slot), sequence_(sequence) {}
+
+        BroadcastRing *ring_ = nullptr;
+        size_t slot_ = 0;
+        uint64_t sequence_ = 0;
+    };
+
+    std::atomic_bool run_async{true};
+
+    // Every slot starts as a copy of |prototype|, so the producer can fill
+    // it in place without allocating
+    BroadcastRing(size_t capacity, const T &prototype)
+        : slots_(capacity < 2 ? 2 : capacity) {
+        for (auto &slot : slots_) {
+            slot.value = prototype;
+        }
+    }
+
+    // Registers a consumer that starts at the next published block
+    int subscribe(Policy policy = Policy::Block) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t id = 0;
+        while (id < consumers_.size() && consumers_[id].active) {
+            id++;
+        }
+        if (id == consumers_.size()) {
+            consumers_.emplace_back();
+        }
+        consumers_[id] = Consumer{};
+        consumers_[id].active = true;
+        consumers_[id].policy = policy;
+        consumers_[id].cursor = head_;
+        return static_cast<int>(id);
+    }
+
+    void unsubscribe(int consumer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            consumers_[consumer].active = false;
+        }
+        space_.notify_all();
+    }
+
+    // Producer: slot for the next block, to be filled and then published.
+    // Waits while a Block consumer is a whole ring behind or a Ref still
+    // pins the slot. Returns nullptr once stopped.
+    T *acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t slot = head_ % slots_.size();
+        space_.wait(lock, [&] {
+            if (!run_async) {
+                return true;
+            }
+            bool free = slots_[slot].refs == 0;
+            for (auto &consumer : consumers_) {
+                if (!consumer.active ||
+                    head_ - consumer.cursor < slots_.size()) {
+                    continue;
+                }
+                if (consumer.policy == Policy::DropOldest) {
+                    consumer.cursor++;
+                    consumer.stats.dropped++;
+                } else {
+                    free = false;
+                }
+            }
+            return free;
+        });
+        if (!run_async) {
+            return nullptr;
+        }
+        return &slots_[slot].value;
+    }
+
+    // Producer: makes the slot returned by acquire() visible to everyone
+    void publish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            head_++;
+            for (auto &consumer : consumers_) {
+                if (consumer.active && head_ - consumer.cursor >
+                                           consumer.stats.max_lag) {
+                    consumer.stats.max_lag = head_ - consumer.cursor;
+                }
+            }
+        }
+        cond_.notify_all();
+    }
+
+    // Same returns as SpscQueue::wait_pop: 1 with a block, -1 with a block
+    // after stop_async, 0 when stopped and this consumer has read it all
+    int wait_pop(int consumer, Ref &ref) {
+        ref.release();
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Not a reference across the wait: subscribe() may grow consumers_
+        cond_.wait(lock, [&] {
+            return consumers_[consumer].cursor != head_ || run_async == false;
+        });
+        Consumer &reader = consumers_[consumer];
+        if (reader.cursor == head_) {
+            return 0;
+        }
+        size_t slot = reader.cursor % slots_.size();
+        slots_[slot].refs++;
+        ref = Ref(this, slot, reader.cursor);
+        reader.cursor++;
+        reader.stats.read++;
+        if (!run_async) {
+            return -1;
+        }
+        return 1;
+    }
+
+    bool empty(int consumer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return consumers_[consumer].cursor == head_;
+    }
+
+    ConsumerStats stats(int consumer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ConsumerStats stats = consumers_[consumer].stats;
+        stats.lag = head_ - consumers_[consumer].cursor;
+        return stats;
+    }
+
+    void start_async() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            run_async = true;
+        }
+        cond_.notify_all();
+        space_.notify_all();
+    }
+
+    void stop_async() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            run_async = false;
+        }
+        cond_.notify_all();
+        space_.notify_all();
+    }
+
+private:
+    struct Slot {
+        T value;
+        int refs = 0;
+    };
+
+    struct Consumer {
+        bool active = false;
+        Policy policy = Policy::Block;
+        uint64_t cursor = 0;
+        ConsumerStats stats;
+    };
+
+    void unpin(size_t slot) {
+        bool free;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free = --slots_[slot].refs == 0;
+        }
+        if (free) {
+            space_.notify_all();
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<Consumer> consumers_;
+    uint64_t head_ = 0;  // blocks published so far
+    std::mutex mutex_;
+    std::condition_variable cond_;   // consumers wait for blocks
+    std::condition_variable space_;  // the producer waits for a free slot
+};
+
+#endif
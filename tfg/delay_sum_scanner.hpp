@@ -0,0 +1,185 @@
+// FILE   : delay_sum_scanner.hpp
+// AUTHOR : Julio Albisua
+// INFO   : Barrido de ángulos del beamforming Delay-and-Sum con la tabla de
+//          retardos calculada una vez por frecuencia y geometría, y sin
+//          reservar memoria por bloque
+
+#ifndef DELAY_SUM_SCANNER_HPP
+#define DELAY_SUM_SCANNER_HPP
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "audio_block.hpp"
+
+// Delay-and-Sum over a circular array, steered to every angle of a sweep.
+// The integer delay of each microphone and angle only depends on the sample
+// rate and the geometry, so the table is built by configure() and reused by
+// every block. Angles whose delays all round to those of an earlier angle
+// give the same beam, so only the first of them is evaluated.
+class DelaySumScanner {
+public:
+    DelaySumScanner(uint16_t channels, float mic_distance, float speed_of_sound,
+                    float angle_min = -180.0f, float angle_max = 180.0f,
+                    float angle_step = 5.0f)
+        : channels_(channels), mic_distance_(mic_distance),
+          speed_of_sound_(speed_of_sound) {
+        if (channels == 0 || (channels & (channels - 1)) != 0) {
+            shift_ = -1;
+        }
+        while (shift_ >= 0 && (1 << shift_) < channels) {
+            ++shift_;
+        }
+        for (float angle_deg = angle_min; angle_deg <= angle_max; angle_deg += angle_step) {
+            angles_.push_back(angle_deg);
+        }
+    }
+
+    // Rebuilds the delay table if the rate changed and sizes the scratch
+    // buffer for blocks of |block_size| samples. Nothing is allocated when
+    // neither changed.
+    void configure(uint32_t sample_rate, uint32_t block_size) {
+        if (sample_rate != sample_rate_) {
+            sample_rate_ = sample_rate;
+            build_table();
+        }
+        if (block_size != sum_.size()) {
+            sum_.assign(block_size, 0);
+        }
+    }
+
+    // Index in angles() of the beam with the most energy, the first one on
+    // a tie. The block needs at least channels() channels, and configure()
+    // must have been called with its rate.
+    size_t scan(const AudioBlock &block) {
+        configure(sample_rate_, block.samples());
+        if (rows_.empty()) {
+            return 0;
+        }
+        int64_t max_energy = -1;
+        size_t best = 0;
+        for (size_t row = 0; row < rows_.size(); ++row) {
+            accumulate(block, row);
+            int64_t energy = beam_energy();
+            if (energy > max_energy) {
+                max_energy = energy;
+                best = row;
+            }
+        }
+        return row_angle_[best];
+    }
+
+    // Beam of angle |index| into |out|, block.samples() values
+    void render(const AudioBlock &block, size_t index, int16_t *out) {
+        configure(sample_rate_, block.samples());
+        if (rows_.empty()) {
+            std::fill(out, out + block.samples(), 0);
+            return;
+        }
+        accumulate(block, angle_row_[index]);
+        const int32_t *__restrict sum = sum_.data();
+        const size_t size = sum_.size();
+        if (shift_ >= 0) {
+            for (size_t i = 0; i < size; ++i) {
+                out[i] = static_cast<int16_t>(shift_average(sum[i]));
+            }
+        } else {
+            for (size_t i = 0; i < size; ++i) {
+                out[i] = static_cast<int16_t>(sum[i] / channels_);
+            }
+        }
+    }
+
+    const std::vector<float> &angles() const { return angles_; }
+    uint16_t channels() const { return channels_; }
+
+    // Distinct beams of the sweep at the current rate
+    size_t beams() const { return rows_.size(); }
+
+private:
+    void build_table() {
+        const float radius = mic_distance_ / (2.0f * sinf(M_PI / channels_));
+        rows_.clear();
+        row_angle_.clear();
+        angle_row_.assign(angles_.size(), 0);
+
+        std::vector<int> delays(channels_);
+        for (size_t a = 0; a < angles_.size(); ++a) {
+            float doa_rad = angles_[a] * M_PI / 180.0f;
+            for (uint16_t ch = 0; ch < channels_; ++ch) {
+                float mic_angle = 2.0f * M_PI * ch / channels_;
+                float x = radius * cosf(mic_angle);
+                float y = radius * sinf(mic_angle);
+                float delay_sec = (x * cosf(doa_rad) + y * sinf(doa_rad)) / speed_of_sound_;
+                delays[ch] = static_cast<int>(std::round(delay_sec * sample_rate_));
+            }
+
+            auto same = std::find(rows_.begin(), rows_.end(), delays);
+            angle_row_[a] = same - rows_.begin();
+            if (same == rows_.end()) {
+                rows_.push_back(delays);
+                row_angle_.push_back(a);
+            }
+        }
+    }
+
+    // sum_[i] = sum over the channels of channel[i + delay], the samples
+    // that fall outside the block count as 0
+    void accumulate(const AudioBlock &block, size_t row) {
+        const int size = static_cast<int>(sum_.size());
+        int32_t *__restrict sum = sum_.data();
+        std::fill(sum_.begin(), sum_.end(), 0);
+        for (uint16_t ch = 0; ch < channels_; ++ch) {
+            const int delay = rows_[row][ch];
+            const int begin = std::max(0, -delay);
+            const int end = std::min(size, size - delay);
+            const int16_t *__restrict x = block.channel(ch);
+            for (int i = begin; i < end; ++i) {
+                sum[i] += x[i + delay];
+            }
+        }
+    }
+
+    // Energy of the beam in sum_, averaged and truncated to 16 bits like the
+    // rendered samples. Each square fits in 31 bits.
+    int64_t beam_energy() const {
+        const int32_t *__restrict sum = sum_.data();
+        const size_t size = sum_.size();
+        int64_t energy = 0;
+        if (shift_ >= 0) {
+            for (size_t i = 0; i < size; ++i) {
+                int32_t sample = static_cast<int16_t>(shift_average(sum[i]));
+                energy += sample * sample;
+            }
+        } else {
+            for (size_t i = 0; i < size; ++i) {
+                int32_t sample = static_cast<int16_t>(sum[i] / channels_);
+                energy += sample * sample;
+            }
+        }
+        return energy;
+    }
+
+    // sum / channels_ for a power of two, rounding towards zero like the
+    // division but without one, which no SIMD unit has
+    int32_t shift_average(int32_t sum) const {
+        return (sum + ((sum >> 31) & ((1 << shift_) - 1))) >> shift_;
+    }
+
+    uint16_t channels_;
+    int shift_ = 0;  // log2 of channels_, -1 if not a power of two
+    float mic_distance_;
+    float speed_of_sound_;
+    uint32_t sample_rate_ = 0;
+    std::vector<float> angles_;
+
+    // Delays of every distinct beam, the first angle that gives each one,
+    // and the beam of every angle
+    std::vector<std::vector<int>> rows_;
+    std::vector<size_t> row_angle_;
+    std::vector<size_t> angle_row_;
+    std::vector<int32_t> sum_;
+};
+
+#endif
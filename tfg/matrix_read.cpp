@@ -16,9 +16,12 @@
 #include "../cpp/driver/microphone_core.h"
 #include "../cpp/driver/everloop.h"
 #include "../cpp/driver/everloop_image.h"
+#include "../cpp/driver/realtime.h"
 
 #include "audio_processor.hpp"
-#include "queue.hpp"
+#include "broadcast_ring.hpp"
+#include "delay_sum_scanner.hpp"
+#include "pipeline.hpp"
 
 using namespace std::chrono_literals;
 
@@ -29,7 +32,14 @@ using namespace std::chrono_literals;
 DEFINE_int32(frequency, 16000, "Frecuencia de muestreo (Hz)");
 DEFINE_int32(duration, 180, "Segundos a grabar");
 DEFINE_int32(gain, 3, "Ganancia del micrófono (dB)");
+DEFINE_int32(block_size, 512, "Muestras por canal de cada bloque leído, no reduce la latencia");
 DEFINE_string(filename, "beamformed_output.wav", "The filename of the beamformed audio");
+DEFINE_string(channels_filename, "", "Graba también los 8 canales con este nombre base (vacío: no)");
+DEFINE_int32(rt_priority, 0, "Prioridad SCHED_FIFO del hilo de captura, 1-99 (0: planificador normal)");
+DEFINE_string(capture_cpus, "", "CPUs del hilo de captura, p. ej. \"3\" o \"2-3\" (vacío: cualquiera)");
+DEFINE_string(dsp_cpus, "", "CPUs del hilo de beamforming (vacío: cualquiera)");
+DEFINE_bool(mlock, false, "Bloquea la memoria del proceso en RAM (mlockall)");
+DEFINE_bool(fuse_output, false, "Guarda y publica en el hilo del beamforming, sin cola intermedia");
 
 float normalize_angle(float angle_deg)
 {
@@ -39,100 +49,81 @@ float normalize_angle(float angle_deg)
         angle_deg += 360.0f;
     return angle_deg;
 }
+// Audio beamformed de un bloque, listo para guardar y publicar
+struct BeamformedBlock
+{
+    std::vector<int16_t> samples;
+    float angle = 0.0f;
+};
+
 // Delay-and-Sum con barrido de ángulos + Everloop
-void process_beamforming(
-    SafeQueue<AudioBlock> &queue,
-    mqtt::async_client& client,
-    std::atomic_bool& running,
+bool beamform_block(
+    const AudioBlock &block,
     uint32_t frequency,
+    DelaySumScanner &scanner,
     matrix_hal::Everloop *everloop,
     matrix_hal::EverloopImage *image,
-    std::string filename,
-    std::string topic,
-    bool drain = true)
+    BeamformedBlock &out)
 {
-    const uint16_t num_channels = 8;
-    const uint16_t bits_per_sample = 16;
-
-    std::ofstream outfile(filename, std::ios::binary);
-    if (!outfile.is_open())
-    {
-        std::cerr << "Error abriendo " << filename << std::endl;
-        running = false;
-        return;
-    }
-
-    const float RADIUS = MIC_DISTANCE / (2.0f * sinf(M_PI / num_channels));
-    const float ANGLE_MIN = -180.0f, ANGLE_MAX = 180.0f, ANGLE_STEP = 5.0f;
     const int num_leds = image->leds.size();
 
-    uint32_t wav_data_len = 0;
-    while (running || (drain && !queue.empty()))
-    {
-        AudioBlock block;
-        int ret = queue.wait_pop(block);
-        if (ret == 0) {
-            continue;
-        }
+    // La tabla de retardos solo se recalcula si cambia la frecuencia
+    scanner.configure(frequency, block.samples());
+    size_t best = scanner.scan(block);
+    float best_angle = scanner.angles()[best];
 
-        uint32_t block_size = block.samples[0].size();
-        float max_energy = -1.0f, best_angle = 0.0f;
-        std::vector<int16_t> best_output(block_size);
+    // Solo se reconstruye el haz ganador
+    out.samples.resize(block.samples());
+    scanner.render(block, best, out.samples.data());
 
-        for (float angle_deg = ANGLE_MIN; angle_deg <= ANGLE_MAX; angle_deg += ANGLE_STEP)
-        {
-            float doa_rad = angle_deg * M_PI / 180.0f;
-            std::vector<int32_t> sum(block_size, 0);
-
-            for (uint16_t ch = 0; ch < num_channels; ++ch)
-            {
-                float mic_angle = 2.0f * M_PI * ch / num_channels;
-                float x = RADIUS * cosf(mic_angle);
-                float y = RADIUS * sinf(mic_angle);
-                float delay_sec = (x * cosf(doa_rad) + y * sinf(doa_rad)) / SPEED_OF_SOUND;
-                int delay_samples = static_cast<int>(round(delay_sec * frequency));
-
-                for (uint32_t i = 0; i < block_size; ++i)
-                {
-                    int idx = static_cast<int>(i) + delay_samples;
-                    if (idx >= 0 && idx < static_cast<int>(block_size))
-                        sum[i] += block.samples[ch][idx];
-                }
-            }
+    float ANGLE_CORRECTION = 15.0f;
+    std::cout << "DOA Calculada: " << normalize_angle(best_angle - ANGLE_CORRECTION) << " grados\n";
 
-            std::vector<int16_t> beamformed(block_size);
-            float energy = 0.0f;
-            for (uint32_t i = 0; i < block_size; ++i)
-            {
-                beamformed[i] = sum[i] / num_channels;
-                energy += beamformed[i] * beamformed[i];
-            }
-            if (energy > max_energy)
-            {
-                max_energy = energy;
-                best_output = beamformed;
-                best_angle = angle_deg;
-            }
-        }
+    // ——— Everloop: limpia, calcula LED y enciende —
+    for (auto &led : image->leds) {
+        led.red = led.green = led.blue = 0;
+    }
 
-        float ANGLE_CORRECTION = 15.0f;
-        std::cout << "DOA Calculada: " << normalize_angle(best_angle - ANGLE_CORRECTION) << " grados\n";
+    float LED_CORRECTION = -110.0f;
+    float angle01 = (normalize_angle(best_angle + LED_CORRECTION) + 180.0f) / 360.0f;
+    int pin = static_cast<int>(round(angle01 * (num_leds - 1)));
+    image->leds[pin].green = 30;
+    everloop->Write(image);
 
-        // ——— Everloop: limpia, calcula LED y enciende —
-        for (auto &led : image->leds) {
-            led.red = led.green = led.blue = 0;
-        }
+    out.angle = best_angle;
+    return true;
+}
+
+// Guarda el audio beamformed en WAV y lo publica por MQTT. Vacía si no se
+// puede abrir el fichero.
+std::function<void(BeamformedBlock &)> beamformed_output_stage(
+    mqtt::async_client &client,
+    uint32_t frequency,
+    std::string filename,
+    std::string topic)
+{
+    struct WavOutput
+    {
+        std::ofstream outfile;
+        uint32_t wav_data_len = 0;
+    };
+    auto wav = std::make_shared<WavOutput>();
+    wav->outfile.open(filename, std::ios::binary);
+    if (!wav->outfile.is_open())
+    {
+        std::cerr << "Error abriendo " << filename << std::endl;
+        return nullptr;
+    }
 
-        float LED_CORRECTION = -110.0f;
-        float angle01 = (normalize_angle(best_angle + LED_CORRECTION) + 180.0f) / 360.0f;
-        int pin = static_cast<int>(round(angle01 * (num_leds - 1)));
-        image->leds[pin].green = 30;
-        everloop->Write(image);
+    return [wav, &client, frequency, topic](BeamformedBlock &beamformed)
+    {
+        const uint16_t bits_per_sample = 16;
+        const std::vector<int16_t> &best_output = beamformed.samples;
 
         // ——— Guarda WAV y publica MQTT —
-        wav_data_len = wav_data_len + best_output.size() * sizeof(int16_t);
-        write_wav_header(outfile, frequency, bits_per_sample, 1, wav_data_len);
-        outfile.write(
+        wav->wav_data_len = wav->wav_data_len + best_output.size() * sizeof(int16_t);
+        write_wav_header(wav->outfile, frequency, bits_per_sample, 1, wav->wav_data_len);
+        wav->outfile.write(
             reinterpret_cast<const char *>(best_output.data()),
             best_output.size() * sizeof(int16_t));
 
@@ -150,10 +141,7 @@ void process_beamforming(
         {
             std::cerr << "Error publicando MQTT: " << exc.what() << std::endl;
         }
-
-    }
-
-    outfile.close();
+    };
 }
 
 int main(int argc, char *argv[])
@@ -168,7 +156,14 @@ int main(int argc, char *argv[])
         "  --duration  : Duración en segundos de la grabación (por defecto: 5)\n"
         "  --filename  : The filename of the beamformed audio\n "
         "                   default: beamformed_output.wav\n"
-        "  --gain      : Ganancia del micrófono en dB, 3 para ganancia por defecto (por defecto: 3)\n");
+        "  --gain      : Ganancia del micrófono en dB, 3 para ganancia por defecto (por defecto: 3)\n"
+        "  --block_size: Muestras por canal de cada bloque, divisor o múltiplo de 512 (por defecto: 512).\n"
+        "                Los bloques menores se entregan al llegar su bloque de 512, sin reducir la latencia\n"
+        "  --channels_filename : Nombre base para grabar además los 8 canales (por defecto: no se graban)\n"
+        "  --rt_priority : Prioridad SCHED_FIFO de la captura, 1-99 (por defecto: 0, sin tiempo real)\n"
+        "  --capture_cpus, --dsp_cpus : CPUs de la captura y del beamforming, p. ej. 3 o 2-3\n"
+        "  --mlock     : Bloquea la memoria en RAM para evitar fallos de página\n"
+        "  --fuse_output : Guarda y publica en el mismo hilo que el beamforming\n");
 
     for (int i = 1; i < argc; ++i)
     {
@@ -181,6 +176,27 @@ int main(int argc, char *argv[])
     }
     google::ParseCommandLineFlags(&argc, &argv, true);
 
+    // Perfil de tiempo real: la captura con SCHED_FIFO y los hilos fijados
+    matrix_hal::RealtimeOptions capture_realtime;
+    matrix_hal::RealtimeOptions dsp_realtime;
+    if (FLAGS_rt_priority < 0 || FLAGS_rt_priority > matrix_hal::kRealtimeMaxPriority ||
+        !matrix_hal::ParseCpuList(FLAGS_capture_cpus, &capture_realtime.cpus) ||
+        !matrix_hal::ParseCpuList(FLAGS_dsp_cpus, &dsp_realtime.cpus)) {
+        std::cerr << "Perfil de tiempo real no válido" << std::endl;
+        return 1;
+    }
+    capture_realtime.priority = FLAGS_rt_priority;
+    if (FLAGS_rt_priority > 0) {
+        capture_realtime.prefault_stack_bytes = 256 * 1024;
+    }
+    if (FLAGS_mlock) {
+        // Para todo el proceso, antes de reservar los buffers
+        std::string error;
+        if (!matrix_hal::LockMemory(&error)) {
+            std::cerr << "Aviso: " << error << std::endl;
+        }
+    }
+
     // Inicializar bus MATRIX
     matrix_hal::MatrixIOBus bus;
     if (!bus.Init()) {
@@ -192,6 +208,9 @@ int main(int argc, char *argv[])
     matrix_hal::MicrophoneCore mic_core(mic_array);
     mic_array.Setup(&bus);
     mic_array.SetSamplingRate(FLAGS_frequency);
+    if (!mic_array.SetBlockSize(FLAGS_block_size)) {
+        return 1;
+    }
 
     if (FLAGS_gain > 0) {
         mic_array.SetGain(FLAGS_gain);
@@ -229,32 +248,112 @@ int main(int argc, char *argv[])
     everloop.Setup(&bus);
     matrix_hal::EverloopImage image(bus.MatrixLeds());
 
-    // Cola de audio
-    SafeQueue<AudioBlock> queue;
-    queue.start_async();
+    // Anillo de audio: una sola captura compartida por todos los consumidores
+    const size_t ring_blocks = 16;
+    BroadcastRing<AudioBlock> ring(
+        ring_blocks,
+        AudioBlock(mic_array.Channels(), mic_array.NumberOfSamples()));
+    ring.start_async();
+    // El beamforming solo muestra la DOA actual: si se retrasa, pierde bloques
+    int beamforming_consumer =
+        ring.subscribe(BroadcastRing<AudioBlock>::Policy::DropOldest);
+    int channels_consumer = -1;
+    if (!FLAGS_channels_filename.empty()) {
+        channels_consumer = ring.subscribe(BroadcastRing<AudioBlock>::Policy::Block);
+    }
+
     // Hilo de captura
-    std::thread capture_thread(capture_audio, &mic_array, std::ref(queue),
-                               std::ref(queue.run_async));
-
-    // Hilo de beamforming + Everloop
-    std::thread processing_thread(
-        process_beamforming,
-        std::ref(queue),
-        std::ref(client),
-        std::ref(queue.run_async),
-        FLAGS_frequency,
-        &everloop,
-        &image,
-        FLAGS_filename,
-        BEAMFORMED_TOPIC,
-        drain_queue
-    );
+    std::thread capture_thread(capture_audio_broadcast, &mic_array,
+                               std::ref(ring), std::ref(ring.run_async),
+                               capture_realtime);
+
+    // Hilo de grabación de los canales, sin pérdidas
+    std::thread channels_thread;
+    if (channels_consumer >= 0) {
+        channels_thread = std::thread(
+            record_all_channels_wav_broadcast, std::ref(ring),
+            channels_consumer, &mic_array, std::ref(ring.run_async),
+            FLAGS_channels_filename, drain_queue);
+    }
+
+    // Pipeline del beamforming: bloques del anillo -> beamforming + Everloop
+    // -> WAV y MQTT. La salida tiene su propio hilo para que el disco o el
+    // broker no retrasen el beamforming.
+    auto output_stage = beamformed_output_stage(
+        client, FLAGS_frequency, FLAGS_filename, BEAMFORMED_TOPIC);
+    if (!output_stage) {
+        ring.stop_async();
+        capture_thread.join();
+        if (channels_thread.joinable()) {
+            channels_thread.join();
+        }
+        return 1;
+    }
+
+    using RingBlock = BroadcastRing<AudioBlock>::Ref;
+    StageOptions source_options;
+    source_options.realtime = dsp_realtime;
+    StageOptions beamforming_options;
+    beamforming_options.fuse = true;  // el anillo ya hace de cola
+    StageOptions output_options;
+    output_options.fuse = FLAGS_fuse_output;
+    output_options.queue_capacity = ring_blocks;
+
+    // Tabla de retardos del barrido, solo la usa el hilo del beamforming
+    const uint16_t num_channels = 8;
+    DelaySumScanner scanner(num_channels, MIC_DISTANCE, SPEED_OF_SOUND);
+    scanner.configure(FLAGS_frequency, mic_array.NumberOfSamples());
+
+    Pipeline pipeline;
+    auto blocks = pipeline.source<RingBlock>(
+        "anillo",
+        [&](RingBlock &block) {
+            // Tras stop_async sigue hasta vaciar su parte del anillo
+            int ret = ring.wait_pop(beamforming_consumer, block);
+            if (ret == 0) {
+                return SourceStatus::End;
+            }
+            if (ret == -1 && !drain_queue) {
+                return SourceStatus::End;
+            }
+            return SourceStatus::Item;
+        },
+        source_options);
+    auto beamformed = pipeline.transform<BeamformedBlock>(
+        "beamforming", blocks,
+        [&](RingBlock &block, BeamformedBlock &out) {
+            bool ok = beamform_block(*block, FLAGS_frequency, scanner, &everloop, &image, out);
+            block.release();  // el productor ya puede reutilizar el hueco
+            return ok;
+        },
+        beamforming_options);
+    pipeline.sink("salida", beamformed, output_stage, output_options);
+    if (!pipeline.start()) {
+        std::cerr << "Error: no se ha podido arrancar el pipeline" << std::endl;
+        ring.stop_async();
+        capture_thread.join();
+        if (channels_thread.joinable()) {
+            channels_thread.join();
+        }
+        return 1;
+    }
 
     std::this_thread::sleep_for(FLAGS_duration * 1s);
-    queue.stop_async();
+    ring.stop_async();
 
     capture_thread.join();
-    processing_thread.join();
+    pipeline.wait();
+    if (channels_thread.joinable()) {
+        channels_thread.join();
+    }
+    pipeline.report(std::cout);
+
+    BroadcastRing<AudioBlock>::ConsumerStats stats = ring.stats(beamforming_consumer);
+    if (stats.dropped > 0) {
+        std::cerr << "Aviso: el beamforming ha descartado " << stats.dropped
+                  << " bloques de " << stats.read + stats.dropped
+                  << " (retraso máximo " << stats.max_lag << " bloques)" << std::endl;
+    }
 
     int retry_count = 5;
     while (!client.get_pending_delivery_tokens().empty()) {
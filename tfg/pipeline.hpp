@@ -0,0 +1,390 @@
+// FILE   : pipeline.hpp
+// AUTHOR : Julio Albisua
+// INFO   : Pipeline de etapas tipadas (fuente, transformación, sumidero)
+//          unidas por colas acotadas. Cada etapa corre en su propio hilo o
+//          fusionada en el hilo de la anterior; se mide el tiempo de CPU de
+//          cada etapa y la ocupación de cada cola, y al parar se vacían en
+//          orden, de la fuente al último sumidero
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+#include "../cpp/driver/realtime.h"
+#include "queue.hpp"
+#include <time.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What a source reports after each call
+enum class SourceStatus {
+    Item,  // |item| was filled, pass it on
+    Skip,  // nothing this time, call again
+    End    // the stream is over, drain and finish
+};
+
+struct StageOptions {
+    // Run on the previous stage's thread, called straight from its emit.
+    // Saves a thread and a queue hop; the queue settings are then unused.
+    bool fuse = false;
+    // Input queue of a stage on its own thread. Block gives backpressure:
+    // a slow stage makes the previous one wait.
+    size_t queue_capacity = 64;
+    OverflowPolicy policy = OverflowPolicy::Block;
+    // Applied to the stage's thread when it starts, if it has its own
+    matrix_hal::RealtimeOptions realtime;
+};
+
+struct StageStats {
+    std::string name;
+    std::string thread;       // stage whose thread runs it
+    uint64_t items = 0;       // calls with an input (or items a source made)
+    double cpu_seconds = 0;   // this stage only, not the fused ones it calls
+    size_t queue_capacity = 0;  // 0 when it has no input queue
+    size_t max_queue_depth = 0;
+    double mean_queue_depth = 0;
+    uint64_t dropped = 0;     // lost to the overflow policy or a stop without drain
+};
+
+class Pipeline {
+    struct Stage;
+
+    template<typename T>
+    struct Output {
+        Stage *owner = nullptr;
+        std::function<void(T &)> deliver;
+    };
+
+    // Keeps the stage function from deducing the port type
+    template<typename T>
+    struct Identity {
+        using type = T;
+    };
+
+public:
+    // Output of a stage; exactly one later stage must consume it
+    template<typename T>
+    class Port {
+    public:
+        Port() = default;
+
+    private:
+        friend class Pipeline;
+        explicit Port(Output<T> *output) : output_(output) {}
+        Output<T> *output_ = nullptr;
+    };
+
+    Pipeline() = default;
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    ~Pipeline() {
+        if (started_) {
+            stop();
+        }
+    }
+
+    // |produce| is called in a loop on the source's own thread until it
+    // returns End or stop() is called
+    template<typename T>
+    Port<T> source(std::string name,
+                   std::function<SourceStatus(T &)> produce,
+                   StageOptions options = {}) {
+        Stage *stage = add_stage(std::move(name), options);
+        stage->thread_owner = stage;
+        auto output = make_output<T>(stage);
+
+        stage->body = [this, stage, produce, output] {
+            matrix_hal::ApplyRealtime(stage->options.realtime);
+            while (running_) {
+                T item{};
+                SourceStatus status = SourceStatus::Skip;
+                timed(*stage, [&] { status = produce(item); });
+                if (status == SourceStatus::End) {
+                    break;
+                }
+                if (status == SourceStatus::Item) {
+                    stage->items++;
+                    output->deliver(item);
+                }
+            }
+            finish(*stage);
+        };
+        return Port<T>(output.get());
+    }
+
+    // |process| returns whether |out| was filled and must be passed on
+    template<typename Out, typename In>
+    Port<Out> transform(
+        std::string name, Port<In> input,
+        typename Identity<std::function<bool(In &, Out &)>>::type process,
+        StageOptions options = {}) {
+        Stage *stage = add_stage(std::move(name), options);
+        auto output = make_output<Out>(stage);
+        connect<In>(stage, input, [stage, process, output](In &item) {
+            Out out{};
+            bool emit = false;
+            timed(*stage, [&] { emit = process(item, out); });
+            // Outside the timing: a fused stage after this one counts its own
+            if (emit) {
+                output->deliver(out);
+            }
+        });
+        return Port<Out>(output.get());
+    }
+
+    template<typename In>
+    void sink(std::string name, Port<In> input,
+              typename Identity<std::function<void(In &)>>::type consume,
+              StageOptions options = {}) {
+        Stage *stage = add_stage(std::move(name), options);
+        connect<In>(stage, input, [stage, consume](In &item) {
+            timed(*stage, [&] { consume(item); });
+        });
+    }
+
+    // Starts every thread. False, and nothing started, if a port has no
+    // consumer or feeds more than one stage.
+    bool start() {
+        if (started_) {
+            return false;
+        }
+        bool valid = true;
+        for (auto &stage : stages_) {
+            if (stage->consumers != 1 && stage->has_output) {
+                std::cerr << "Pipeline: la salida de '" << stage->name
+                          << "' tiene " << stage->consumers
+                          << " consumidores, debe tener 1" << std::endl;
+                valid = false;
+            }
+        }
+        if (!valid) {
+            return false;
+        }
+
+        running_ = true;
+        drain_ = true;
+        started_ = true;
+        for (auto &stage : stages_) {
+            if (stage->thread_owner == stage.get()) {
+                stage->thread = std::thread(stage->body);
+            }
+        }
+        return true;
+    }
+
+    // Asks the sources to finish and waits for every stage. With |drain|
+    // every queued item is still processed, in order; without it the
+    // queues are emptied and their items dropped.
+    void stop(bool drain = true) {
+        drain_ = drain;
+        running_ = false;
+        if (!drain) {
+            for (auto &stage : stages_) {
+                if (stage->close_input) {
+                    stage->close_input();
+                }
+            }
+        }
+        wait();
+    }
+
+    // Waits for the sources to end on their own and everything to drain
+    void wait() {
+        for (auto &stage : stages_) {
+            if (stage->thread.joinable()) {
+                stage->thread.join();
+            }
+        }
+        started_ = false;
+    }
+
+    // Stops the sources from another thread without waiting
+    void request_stop() { running_ = false; }
+
+    bool running() const { return running_; }
+
+    std::vector<StageStats> stats() const {
+        std::vector<StageStats> all;
+        for (auto &stage : stages_) {
+            StageStats stats;
+            stats.name = stage->name;
+            stats.thread = stage->thread_owner->name;
+            stats.items = stage->items;
+            stats.cpu_seconds = stage->cpu_ns * 1e-9;
+            stats.queue_capacity = stage->queue_capacity;
+            stats.max_queue_depth = stage->max_depth;
+            uint64_t samples = stage->depth_samples;
+            stats.mean_queue_depth =
+                samples ? double(stage->depth_sum) / samples : 0.0;
+            stats.dropped = stage->dropped + (stage->queue_dropped
+                                                  ? stage->queue_dropped()
+                                                  : 0);
+            all.push_back(stats);
+        }
+        return all;
+    }
+
+    void report(std::ostream &out) const {
+        out << "Pipeline:" << std::endl;
+        for (const StageStats &stats : this->stats()) {
+            out << "  " << std::left << std::setw(16) << stats.name
+                << std::right << " hilo " << stats.thread << ", "
+                << stats.items << " elementos, CPU " << std::fixed
+                << std::setprecision(3) << stats.cpu_seconds << " s";
+            if (stats.items > 0) {
+                out << " (" << std::setprecision(1)
+                    << stats.cpu_seconds * 1e6 / stats.items << " us/elem)";
+            }
+            if (stats.queue_capacity > 0) {
+                out << ", cola " << std::setprecision(1)
+                    << stats.mean_queue_depth << " media, "
+                    << stats.max_queue_depth << " max de "
+                    << stats.queue_capacity;
+            }
+            if (stats.dropped > 0) {
+                out << ", " << stats.dropped << " descartados";
+            }
+            out << std::defaultfloat << std::endl;
+        }
+    }
+
+private:
+    struct Stage {
+        std::string name;
+        StageOptions options;
+        Stage *upstream = nullptr;      // stage feeding this one
+        Stage *thread_owner = nullptr;  // stage whose thread runs this one
+        bool has_output = false;
+        int consumers = 0;
+
+        std::function<void()> body;          // thread loop, if it owns one
+        std::function<void()> close_output;  // ends the next queue, if any
+        std::function<void()> close_input;   // ends its own queue, if any
+        std::function<uint64_t()> queue_dropped;
+        std::thread thread;
+
+        std::atomic<uint64_t> items{0};
+        std::atomic<uint64_t> cpu_ns{0};
+        std::atomic<uint64_t> dropped{0};
+        size_t queue_capacity = 0;
+        std::atomic<uint64_t> depth_sum{0};
+        std::atomic<uint64_t> depth_samples{0};
+        std::atomic<size_t> max_depth{0};
+    };
+
+    static uint64_t thread_cpu_ns() {
+        timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return uint64_t(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    }
+
+    // Runs |work| for |stage| and charges it the thread's CPU time. Stages
+    // hand their output on outside of it, so fused stages are not counted
+    // twice.
+    template<typename Work>
+    static void timed(Stage &stage, Work work) {
+        uint64_t start = thread_cpu_ns();
+        work();
+        stage.cpu_ns += thread_cpu_ns() - start;
+    }
+
+    Stage *add_stage(std::string name, const StageOptions &options) {
+        stages_.emplace_back(new Stage());
+        Stage *stage = stages_.back().get();
+        stage->name = std::move(name);
+        stage->options = options;
+        return stage;
+    }
+
+    template<typename T>
+    std::shared_ptr<Output<T>> make_output(Stage *stage) {
+        auto output = std::make_shared<Output<T>>();
+        output->owner = stage;
+        // Until connected nothing consumes it; start() refuses that
+        output->deliver = [](T &) {};
+        stage->has_output = true;
+        storage_.push_back(output);
+        return output;
+    }
+
+    template<typename In>
+    void connect(Stage *stage, Port<In> input, std::function<void(In &)> work) {
+        Output<In> *output = input.output_;
+        Stage *upstream = output->owner;
+        stage->upstream = upstream;
+        upstream->consumers++;
+
+        if (stage->options.fuse) {
+            stage->thread_owner = upstream->thread_owner;
+            output->deliver = [stage, work](In &item) {
+                stage->items++;
+                work(item);
+            };
+            return;
+        }
+
+        stage->thread_owner = stage;
+        auto queue = std::make_shared<SpscQueue<In>>(
+            stage->options.queue_capacity, stage->options.policy);
+        storage_.push_back(queue);
+        stage->queue_capacity = queue->capacity();
+        stage->queue_dropped = [queue] { return queue->dropped(); };
+        stage->close_input = [queue] { queue->stop_async(); };
+        // The queue is closed once the thread feeding it has finished
+        upstream->close_output = [queue] { queue->stop_async(); };
+
+        output->deliver = [stage, queue](In &item) {
+            size_t depth = queue->size();
+            stage->depth_sum += depth;
+            stage->depth_samples++;
+            if (depth > stage->max_depth) {
+                stage->max_depth = depth;
+            }
+            queue->push(std::move(item));
+        };
+
+        stage->body = [this, stage, queue, work] {
+            matrix_hal::ApplyRealtime(stage->options.realtime);
+            In item{};
+            while (true) {
+                int ret = queue->wait_pop(item);
+                if (ret == 0) {
+                    break;  // closed and empty
+                }
+                if (ret == -1 && !drain_) {
+                    stage->dropped++;
+                    item = In{};
+                    continue;
+                }
+                stage->items++;
+                work(item);
+                item = In{};  // let pooled items go back right away
+            }
+            finish(*stage);
+        };
+    }
+
+    // Closes every queue fed from |stage|'s thread, including those of
+    // fused stages further down, so their consumers drain and finish
+    void finish(Stage &stage) {
+        for (auto &other : stages_) {
+            if (other->thread_owner == &stage && other->close_output) {
+                other->close_output();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Stage>> stages_;
+    std::vector<std::shared_ptr<void>> storage_;
+    std::atomic_bool running_{false};
+    std::atomic_bool drain_{true};
+    bool started_ = false;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "../../../../../cpp/driver/matrixio_bus.h"
 #include "../../../../../cpp/driver/microphone_array.h"
 #include "../../../../../cpp/driver/microphone_core.h"
+#include "../../../../../cpp/driver/realtime.h"
 #include "../matrix.h"
 #include <atomic>
 #include <condition_variable>
@@ -55,20 +56,29 @@ struct AudioBlock {
 void producer_async_fun(matrix_hal::MicrophoneArray &mic_array,
                         SafeQueue<AudioBlock> &queue,
                         std::atomic<bool> &running,
-                        std::atomic<int> &len_queue) {
+                        std::atomic<int> &len_queue,
+                        matrix_hal::RealtimeOptions realtime) {
+
+  // Before the first read, so the Python GC or logging can't delay the
+  // wakeup once the capture is running
+  matrix_hal::ApplyRealtime(realtime);
 
   const uint32_t BLOCK_SIZE = mic_array.NumberOfSamples();
   const uint16_t CHANNELS = mic_array.Channels();
 
+  // The block arrives planar, so every channel is one contiguous slice
+  std::vector<int16_t> planar(CHANNELS * BLOCK_SIZE);
+
   while (running) {
-    AudioBlock block;
-    block.samples.resize(CHANNELS, std::vector<int16_t>(BLOCK_SIZE));
-    mic_array.Read();
+    if (!mic_array.ReadInto(planar.data(), matrix_hal::kPlanar)) {
+      continue;
+    }
 
-    for (uint32_t s = 0; s < BLOCK_SIZE; ++s) {
-      for (uint16_t ch = 0; ch < CHANNELS; ++ch) {
-        block.samples[ch][s] = mic_array.At(s, ch);
-      }
+    AudioBlock block;
+    block.samples.resize(CHANNELS);
+    for (uint16_t ch = 0; ch < CHANNELS; ++ch) {
+      block.samples[ch].assign(planar.begin() + ch * BLOCK_SIZE,
+                               planar.begin() + (ch + 1) * BLOCK_SIZE);
     }
     queue.push(block);
     len_queue++;
@@ -81,6 +91,7 @@ private:
   std::atomic<bool> async_running;
   SafeQueue<AudioBlock> queue;
   std::atomic<int> len_queue{0};
+  matrix_hal::RealtimeOptions realtime;
 
   // NOTE: I don't like this, and we could use pointers to initialize them in
   // the constructor but... Initialization of class members is always in the
@@ -96,6 +107,7 @@ private:
 public:
   Microphones(int freq, int gain);
   ~Microphones();
+  bool set_realtime(int priority, std::vector<int> cpus, bool lock_memory);
   void start_async();
   void stop_async(bool drain_queue = false);
   std::vector<std::vector<int16_t>> read_sync();
@@ -128,6 +140,20 @@ Microphones::~Microphones() {
   }
 }
 
+// Takes effect on the next start_async. Returns false when the values are
+// out of range; missing privileges are only reported when the thread starts.
+bool Microphones::set_realtime(int priority, std::vector<int> cpus,
+                               bool lock_memory) {
+  if (priority < 0 || priority > matrix_hal::kRealtimeMaxPriority) {
+    return false;
+  }
+  realtime.priority = priority;
+  realtime.cpus = cpus;
+  realtime.lock_memory = lock_memory;
+  realtime.prefault_stack_bytes = priority > 0 ? 256 * 1024 : 0;
+  return true;
+}
+
 void Microphones::start_async() {
   py::gil_scoped_release release; // Release the GIL in this function
 
@@ -146,8 +172,8 @@ void Microphones::start_async() {
 
   this->bck_thread = std::move(
       std::thread(&producer_async_fun, std::ref(mic_array), std::ref(queue),
-                  std::ref(async_running),
-                  std::ref(len_queue))); // But, it works with a free function
+                  std::ref(async_running), std::ref(len_queue),
+                  realtime)); // But, it works with a free function
 }
 
 void Microphones::stop_async(bool drain_queue /* = false */) {
@@ -175,14 +201,14 @@ AudioBlock Microphones::producer_sync() {
   const uint32_t BLOCK_SIZE = mic_array.NumberOfSamples();
   const uint16_t CHANNELS = mic_array.Channels();
 
-  AudioBlock block;
-  block.samples.resize(CHANNELS, std::vector<int16_t>(BLOCK_SIZE));
-  mic_array.Read();
+  std::vector<int16_t> planar(CHANNELS * BLOCK_SIZE);
+  mic_array.ReadInto(planar.data(), matrix_hal::kPlanar);
 
-  for (uint32_t s = 0; s < BLOCK_SIZE; ++s) {
-    for (uint16_t ch = 0; ch < CHANNELS; ++ch) {
-      block.samples[ch][s] = mic_array.At(s, ch);
-    }
+  AudioBlock block;
+  block.samples.resize(CHANNELS);
+  for (uint16_t ch = 0; ch < CHANNELS; ++ch) {
+    block.samples[ch].assign(planar.begin() + ch * BLOCK_SIZE,
+                             planar.begin() + (ch + 1) * BLOCK_SIZE);
   }
   return block;
 }
@@ -218,6 +244,8 @@ bool Microphones::is_async_running() { return async_running.load(); }
 void init_microphones(py::module &m) {
   py::class_<Microphones>(m, "microphone")
       .def(py::init<const int, const int>())
+      .def("set_realtime", &Microphones::set_realtime, py::arg("priority") = 0,
+           py::arg("cpus") = std::vector<int>{}, py::arg("lock_memory") = false)
       .def("start_async", &Microphones::start_async)
       .def("stop_async", &Microphones::stop_async, py::arg("drain") = false)
       .def("len_async_queue", &Microphones::len_async_queue)
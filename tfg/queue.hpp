@@ -1,95 +1,236 @@
 // FILE   : queue.hpp
 // AUTHOR : Julio Albisua
-// INFO   : SafeQueue utils  with some special functions like wait_pop
-//          Designed for multithreading and trying to be a package lossless tool
+// INFO   : SpscQueue utils with some special functions like wait_pop
+//          Bounded lock-free single producer / single consumer queue:
+//          elements are moved, never copied, and a full queue blocks or
+//          drops as configured instead of growing without limit
 
 #ifndef UTILS_HPP
 #define UTILS_HPP
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <atomic>
-#include <vector>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// What push does when the queue is full
+enum class OverflowPolicy {
+    Block,       // wait for the consumer, nothing is lost
+    DropNewest,  // discard the element being pushed
+    DropOldest   // discard the oldest queued element to make room
+};
 
 template<typename T>
-class SafeQueue {
+class SpscQueue {
 public:
     std::atomic_bool run_async{true};
+
 private:
-    std::queue<T> queue_;
-    std::mutex mutex_;
-    std::condition_variable cond_;
+    // Cache line size on the Pi and on x86
+    static constexpr size_t kCacheLine = 64;
+
+    // Vyukov's bounded queue: sequence == position when the slot is free
+    // for the producer, position + 1 once it holds an element
+    struct alignas(kCacheLine) Slot {
+        std::atomic<uint64_t> sequence;
+        T value;
+    };
+
+    const size_t capacity_;
+    const OverflowPolicy policy_;
+    std::unique_ptr<Slot[]> slots_;
+
+    // Each index on its own cache line so producer and consumer do not
+    // invalidate each other. head_ is also advanced by the producer when it
+    // drops the oldest element.
+    alignas(kCacheLine) std::atomic<uint64_t> head_{0};
+    alignas(kCacheLine) std::atomic<uint64_t> tail_{0};
+    alignas(kCacheLine) std::atomic<uint64_t> dropped_{0};
+
+    // Futex words, bumped on every push and pop. The flags avoid the
+    // wake syscall when nobody sleeps.
+    alignas(kCacheLine) std::atomic<uint32_t> pushes_{0};
+    std::atomic_bool consumer_waiting_{false};
+    alignas(kCacheLine) std::atomic<uint32_t> pops_{0};
+    std::atomic_bool producer_waiting_{false};
+
 public:
-    void push(const T& item) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            queue_.push(item);
+    explicit SpscQueue(size_t capacity = 64,
+                       OverflowPolicy policy = OverflowPolicy::Block)
+        : capacity_(capacity < 1 ? 1 : capacity), policy_(policy),
+          slots_(new Slot[capacity < 1 ? 1 : capacity]) {
+        for (size_t i = 0; i < capacity_; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
         }
-        cond_.notify_one();
     }
 
-    bool pop(T& item) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (queue_.empty()) return false;
-        item = queue_.front();
-        queue_.pop();
-        return true;
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Producer only. Returns false when |item| was dropped, by DropNewest
+    // or because the queue was stopped while blocked.
+    bool push(T item) {
+        while (true) {
+            uint64_t tail = tail_.load(std::memory_order_relaxed);
+            Slot &slot = slots_[tail % capacity_];
+            if (slot.sequence.load(std::memory_order_acquire) == tail) {
+                slot.value = std::move(item);
+                slot.sequence.store(tail + 1, std::memory_order_release);
+                tail_.store(tail + 1, std::memory_order_release);
+                pushes_.fetch_add(1);
+                if (consumer_waiting_.load()) {
+                    wake(pushes_);
+                }
+                return true;
+            }
+
+            uint64_t head = head_.load(std::memory_order_acquire);
+            if (tail - head < capacity_) {
+                // Not full, the consumer is still moving out of this slot
+                std::this_thread::yield();
+                continue;
+            }
+
+            switch (policy_) {
+            case OverflowPolicy::DropNewest:
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case OverflowPolicy::DropOldest:
+                drop_oldest(head);
+                break;
+            case OverflowPolicy::Block:
+                if (!run_async) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                wait_for_space(tail);
+                break;
+            }
+        }
     }
 
-    int wait_pop(T& item) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        // Note that we can have spureus wakeups, in addition to notified ones.
-        // That means that this may not work perfectly, but it should generally
-        // work. And even if this wakes up we have the return values to
-        // communicate the situation.
-        cond_.wait(lock, [&] {
-            // Exit the wait when the queue has data or we are no longer
-            // running. If we don't use run_async, we can have a deadlock if we
-            // are waiting and the threads are no longer producing (running =
-            // false;). This way we wake up when running == false and return 0.
-            return queue_.empty() == false || run_async == false;
-        });
-        if(queue_.empty()) {
-            // If the queue if empty, return 0 to indicate we have no more values.
-            // This is only possible if we are woken up with run_async == false.
-            return 0;
+    // Consumer only, never blocks
+    bool pop(T &item) {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        while (true) {
+            Slot &slot = slots_[head % capacity_];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            int64_t ready = int64_t(sequence - (head + 1));
+            if (ready < 0) {
+                return false;  // empty
+            }
+            if (ready > 0) {
+                // The producer dropped it meanwhile
+                head = head_.load(std::memory_order_acquire);
+                continue;
+            }
+            if (head_.compare_exchange_weak(head, head + 1,
+                                            std::memory_order_acq_rel)) {
+                item = std::move(slot.value);
+                release_slot(slot, head);
+                return true;
+            }
         }
-        item = queue_.front();
-        queue_.pop();
-        if(!run_async) {
-            // Return -1 if we have stopped producing, but we have more data in the queue.
-            return -1;
+    }
+
+    int wait_pop(T &item) {
+        while (true) {
+            // Read the futex word first: a push after this changes it and the
+            // wait below returns at once, so no wakeup is lost
+            uint32_t observed = pushes_.load();
+            if (pop(item)) {
+                // Return -1 if we have stopped producing, but we have more
+                // data in the queue. Return 1 if we are producing more values.
+                return run_async ? 1 : -1;
+            }
+            if (!run_async) {
+                // The queue is empty and nobody is producing: no more values.
+                return 0;
+            }
+            consumer_waiting_.store(true);
+            wait(pushes_, observed);
+            consumer_waiting_.store(false);
         }
-        // Return 1 if we are producing more values, and we have data in the queue.
-        return 1;
     }
 
     bool empty() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        return queue_.empty();
+        return tail_.load(std::memory_order_acquire) ==
+               head_.load(std::memory_order_acquire);
+    }
+
+    size_t size() {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        return tail_.load(std::memory_order_acquire) - head;
     }
 
+    size_t capacity() const { return capacity_; }
+
+    // Elements lost to the overflow policy
+    uint64_t dropped() { return dropped_.load(std::memory_order_relaxed); }
+
     void start_async() {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            run_async = true;
-        }
-        cond_.notify_all();
+        run_async = true;
+        notify_all();
     }
 
     void stop_async() {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            run_async = false;
+        run_async = false;
+        notify_all();
+    }
+
+private:
+    void release_slot(Slot &slot, uint64_t head) {
+        slot.sequence.store(head + capacity_, std::memory_order_release);
+        pops_.fetch_add(1);
+        if (producer_waiting_.load()) {
+            wake(pops_);
+        }
+    }
+
+    void drop_oldest(uint64_t head) {
+        // Claim the oldest element like the consumer would; if the consumer
+        // got there first there is room again
+        if (!head_.compare_exchange_strong(head, head + 1,
+                                           std::memory_order_acq_rel)) {
+            return;
         }
-        cond_.notify_all();
+        Slot &slot = slots_[head % capacity_];
+        T discarded = std::move(slot.value);
+        slot.sequence.store(head + capacity_, std::memory_order_release);
+        dropped_.fetch_add(1, std::memory_order_relaxed);
     }
 
+    void wait_for_space(uint64_t tail) {
+        uint32_t observed = pops_.load();
+        if (tail - head_.load(std::memory_order_acquire) < capacity_ ||
+            !run_async) {
+            return;
+        }
+        producer_waiting_.store(true);
+        wait(pops_, observed);
+        producer_waiting_.store(false);
+    }
 
-};
+    void notify_all() {
+        pushes_.fetch_add(1);
+        pops_.fetch_add(1);
+        wake(pushes_);
+        wake(pops_);
+    }
+
+    static void wait(std::atomic<uint32_t> &word, uint32_t observed) {
+        // Sleeps only while |word| still holds |observed|
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+                FUTEX_WAIT_PRIVATE, observed, nullptr, nullptr, 0);
+    }
 
-struct AudioBlock {
-    std::vector<std::vector<int16_t>> samples;
+    static void wake(std::atomic<uint32_t> &word) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+                FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    }
 };
 
 #endif
@@ -7,6 +7,7 @@
 #include "../cpp/driver/microphone_array.h"
 #include "../cpp/driver/microphone_core.h"
 #include "audio_processor.hpp"
+#include "pipeline.hpp"
 #include <thread>
 
 using namespace std::chrono_literals;
@@ -53,16 +54,27 @@ int main() {
   mqtt_opts.set_port(SERVER_PORT);
   mqtt_opts.set_id(CLIENT_ID);
 
-  SafeQueue<AudioBlock> q{};
-  q.start_async();
-  std::thread prod{capture_audio, &mic_array, std::ref(q),
-                   std::ref(q.run_async)};
-  std::thread cons{send_audio_mqtt_async, &mic_array, std::ref(q),
-                   std::ref(q.run_async), mqtt_opts,  true};
+  // Every block in flight comes from here: the queue, one being captured and
+  // one being consumed. Declared first so it outlives the pipeline.
+  AudioBlockPool pool{64 + 2, mic_array.Channels(),
+                      mic_array.NumberOfSamples()};
+
+  // A stalled broker must not hold up the capture: keep the newest blocks
+  StageOptions mqtt_stage_options;
+  mqtt_stage_options.queue_capacity = 64;
+  mqtt_stage_options.policy = OverflowPolicy::DropOldest;
+
+  Pipeline pipeline;
+  auto blocks = pipeline.source<PooledAudioBlock>(
+      "captura", audio_capture_stage(&mic_array, pool));
+  pipeline.sink("mqtt", blocks, mqtt_publish_stage(mqtt_opts),
+                mqtt_stage_options);
+  if (!pipeline.start()) {
+    return 1;
+  }
 
   std::this_thread::sleep_for(duration * 1s);
 
-  q.stop_async();
-  prod.join();
-  cons.join();
+  pipeline.stop(true);
+  pipeline.report(std::cerr);
 }
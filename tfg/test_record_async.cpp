@@ -7,7 +7,7 @@
 #include "../cpp/driver/microphone_array.h"
 #include "../cpp/driver/microphone_core.h"
 #include "audio_processor.hpp"
-#include "queue.hpp"
+#include "pipeline.hpp"
 #include <thread>
 
 using namespace std::chrono_literals;
@@ -41,16 +41,27 @@ int main() {
   mic_array.ShowConfiguration();
   mic_core.Setup(&bus);
 
-  SafeQueue<AudioBlock> q{};
-  q.start_async();
-  std::thread prod{capture_audio, &mic_array, std::ref(q),
-                   std::ref(q.run_async)};
-  std::thread cons{record_all_channels_wav, std::ref(q),   &mic_array,
-                   std::ref(q.run_async),   BASE_FILENAME, true};
+  // Every block in flight comes from here: the queue, one being captured and
+  // one being consumed. Declared first so it outlives the pipeline.
+  AudioBlockPool pool{64 + 2, mic_array.Channels(),
+                      mic_array.NumberOfSamples()};
+
+  // Lossless: if the disk falls behind the capture waits, bounded to 64 blocks
+  StageOptions wav_options;
+  wav_options.queue_capacity = 64;
+  wav_options.policy = OverflowPolicy::Block;
+
+  Pipeline pipeline;
+  auto blocks = pipeline.source<PooledAudioBlock>(
+      "captura", audio_capture_stage(&mic_array, pool));
+  pipeline.sink("wav", blocks, wav_channels_stage(&mic_array, BASE_FILENAME),
+                wav_options);
+  if (!pipeline.start()) {
+    return 1;
+  }
 
   std::this_thread::sleep_for(duration * 1s);
-  q.stop_async();
-  prod.join();
-  cons.join();
+  pipeline.stop(true);
+  pipeline.report(std::cerr);
   return 0;
 }